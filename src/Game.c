@@ -9,6 +9,33 @@
 const char const *SAVE_FILE = "game.sav";
 const uint32_t SAVE_VERSION = 1;
 
+// cJSON allocates every node and string on its own, while a document is parsed they all come from
+// the document's own arena instead and the whole document is freed with it. cJSON's hooks are global
+// so this is only set for the length of a parse.
+static trs_Arena gJSONParseArena;
+
+static void *jsonArenaAlloc(size_t size) {
+    return trs_ArenaAlloc(gJSONParseArena, size);
+}
+
+static void jsonArenaFree(void *ptr) {
+    (void)ptr; // freed with the arena
+}
+
+cJSON *gameParseJSON(const char *text, size_t size, trs_Arena *arena) {
+    *arena = trs_CreateArena((size * 8) + 4096); // about what cJSON needs per byte of json
+    gJSONParseArena = *arena;
+    cJSON_InitHooks(&(cJSON_Hooks){.malloc_fn = jsonArenaAlloc, .free_fn = jsonArenaFree});
+    cJSON *json = cJSON_ParseWithLength(text, size);
+    cJSON_InitHooks(NULL);
+    gJSONParseArena = NULL;
+    return json;
+}
+
+void gameFreeJSON(trs_Arena arena) {
+    trs_FreeArena(arena);
+}
+
 void gameSave(GameState *game) {
     // TODO: This
 }
@@ -17,11 +44,13 @@ void gameLoad(GameState *game) {
     int size;
     uint8_t *file = trs_LoadFile("game.sav", &size);
     if (file != NULL) {
-        file = realloc(file, size + 1);
-        file[size] = 0;
-        cJSON *json = cJSON_Parse(file);
+        trs_Arena arena;
+        cJSON *json = gameParseJSON((const char*)file, size, &arena);
 
         // TODO: This
+        (void)json;
+        gameFreeJSON(arena);
+        free(file);
     }
 }
 
@@ -32,12 +61,19 @@ void gameStart(GameState *game) {
     // Basic game assets
     game->font = trs_LoadFont("res/font.png", 7, 8);
     game->menuFont = trs_LoadFont("res/font2.png", 16, 16);
-    game->compassTex = trs_LoadPNG("res/compass.png");
+    game->compassTex = trs_LoadImage("res/compass.png");
     game->playerModel = trs_LoadModel("res/player.obj");
     game->platformModel = trs_LoadModel("res/platform.obj");
     game->islandModel = trs_LoadModel("res/island.obj");
-    game->hintTex = trs_LoadPNG("res/hint.png");
+    game->hintTex = trs_LoadImage("res/hint.png");
     game->flagModel = trs_LoadModel("res/flag.obj");
+    trs_SetModelOccluder(game->platformModel, true);
+    trs_SetModelOccluder(game->islandModel, true);
+    trs_SetSortMode(TRS_SORT_INSTANCES);
+    trs_SetTemporalSort(true);
+    trs_SetGovernor(1.0 / 60.0);
+    trs_SetFog(true);
+    trs_SetFrameReuse(true);
 
     // Ground plane
     const float groundSize = 2;
@@ -74,6 +110,9 @@ void gameStart(GameState *game) {
         {{size + 5, size, 0, 1},   {72 / 128.0f,  8 / 128.0f}}
     };
     game->testModel = trs_CreateModel(vl, 18);
+
+    // Everything is loaded, put all the images in one texture
+    trs_BuildAtlas();
     
     // Player
     menuStart(game, &game->menu);
@@ -97,8 +136,8 @@ void gameEnd(GameState *game) {
     trs_FreeModel(game->platformModel);
     trs_FreeModel(game->islandModel);
     trs_FreeModel(game->flagModel);
-    SDL_DestroyTexture(game->compassTex);
-    SDL_DestroyTexture(game->hintTex);
+    trs_FreeImage(game->compassTex);
+    trs_FreeImage(game->hintTex);
 }
 
 // Returns false if the game should quit
@@ -136,6 +175,9 @@ void gameUI(GameState *game) {
 
     // Debug
     trs_DrawFont(game->font, 1, 0, "FPS: %0.2f\nTriangles: %i", game->fps, trs_GetTriangleCount());
+
+    // Draw everything queued this frame
+    trs_Batch2DFlush();
 }
 
 SaveLevelInfo *gameSaveGetScores(GameState *game, const char *levelName) {
@@ -1,4 +1,5 @@
 #include "Structs.h"
+#include "cJSON.h"
 #pragma once
 
 void gameSave(GameState *game);
@@ -9,4 +10,6 @@ void gameDraw(GameState *game);
 void gameUI(GameState *game);
 SaveLevelInfo *gameSaveGetScores(GameState *game, const char *levelName);
 // Returns true if time is a highscore
-bool gameSaveSetScores(GameState *game, const char *levelName, float *checkpointTimes, int checkpointCount, float time);
\ No newline at end of file
+bool gameSaveSetScores(GameState *game, const char *levelName, float *checkpointTimes, int checkpointCount, float time);
+cJSON *gameParseJSON(const char *text, size_t size, trs_Arena *arena); // the document lives in *arena, parse on one thread at a time
+void gameFreeJSON(trs_Arena arena); // frees a document from gameParseJSON, never cJSON_Delete one
\ No newline at end of file
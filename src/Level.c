@@ -1,6 +1,8 @@
-#include "cJSON.h"
+#include <stdio.h>
 #include "Software3D.h"
 #include "Level.h"
+#include "LevelFile.h"
+#include "LevelParser.h"
 #include "Player.h"
 
 //******************************** Chunks ********************************//
@@ -10,8 +12,14 @@
 // The chunk at player position +/- 1 chunk are handled each frame.
 const float CHUNK_WIDTH = 15.0f;
 
-// Returns the index of the chunk this coordinate would belong to
-static int getChunkIndex(float x, float y) {
+// Only the chunks around the player keep their walls in memory, the chunk past those in the direction the
+// player is going is loaded ahead of time on another thread and chunks far enough away are unloaded
+const int CHUNK_PREFETCH_DISTANCE = 2;
+const int CHUNK_EVICT_DISTANCE = 3;
+const int CHUNK_LOADER_POLL_MS = 5;
+
+// Returns how far along the chunks this coordinate is
+static float getChunkDistance(float x, float y) {
     //x = floorf(x);
     //y = floorf(y);
 
@@ -19,28 +27,104 @@ static int getChunkIndex(float x, float y) {
     if (y < x) return 0;
     
     // Casts the coordinate to the line y=-x and find the distance on that line from the origin
-    const float distance = sqrtf((powf(x, 2) + powf(y, 2)) - powf((-x - y) / (GLM_SQRT2), 2));
-    const int out = (int)floorf(distance / CHUNK_WIDTH);
+    return sqrtf((powf(x, 2) + powf(y, 2)) - powf((-x - y) / (GLM_SQRT2), 2));
+}
+
+// Returns the index of the chunk this coordinate would belong to
+static int getChunkIndex(float x, float y) {
+    const int out = (int)floorf(getChunkDistance(x, y) / CHUNK_WIDTH);
     return out >= 0 ? out : 0;
 }
 
-// Returns the chunk at a given index, creating it if it doesn't exist
-static Chunk *getChunkAtIndex(Level *level, int index) {
-    if (index < 0) return NULL;
-    if (level->chunkCount <= index) {
-        // Allocate new chunks up to this point
-        int oldSize = level->chunkCount;
-        level->chunks = realloc(level->chunks, sizeof(struct Chunk_t) * (index + 1));
-        level->chunkCount = index + 1;
+// Frees a chunk's walls
+static void unloadChunk(Level *level, int index) {
+    Chunk *chunk = &level->chunks[index];
+    if (level->mostRecentWall != NULL && level->mostRecentWall->chunk == index)
+        level->mostRecentWall = NULL;
+    free(chunk->walls);
+    free(chunk->wallList);
+    trs_FreeBSP(chunk->bsp);
+    chunk->bsp = NULL;
+    chunk->walls = NULL;
+    chunk->wallList = NULL;
+    chunk->wallCount = 0;
+    chunk->wallSlots = 0;
+    chunk->wallFree = -1;
+    SDL_AtomicSet(&chunk->state, CHUNK_UNLOADED);
+}
 
-        // Zero all the chunks up to the new size
-        for (int i = oldSize; i < level->chunkCount; i++) {
-            level->chunks[i].wallCount = 0;
+// Allocates every chunk the budgets allow for up front, walls are allocated when a chunk is loaded
+static void allocateChunks(Level *level) {
+    if (level->chunks == NULL) {
+        level->chunks = malloc(sizeof(struct Chunk_t) * LEVEL_MAX_CHUNKS);
+        for (int i = 0; i < LEVEL_MAX_CHUNKS; i++) {
             level->chunks[i].walls = NULL;
-            level->chunks[i].checkpointCount = 0;
-            level->chunks[i].checkpoints = NULL;
+            level->chunks[i].wallList = NULL;
+            level->chunks[i].bsp = NULL;
+            level->chunks[i].checkpoints = malloc(sizeof(struct Checkpoint_t) * LEVEL_MAX_CHECKPOINTS);
+            level->chunks[i].checkpointList = malloc(sizeof(int) * LEVEL_MAX_CHECKPOINTS);
         }
     }
+    for (int i = 0; i < LEVEL_MAX_CHUNKS; i++) {
+        if (level->chunks[i].walls != NULL)
+            unloadChunk(level, i);
+        SDL_AtomicSet(&level->chunks[i].state, CHUNK_UNLOADED);
+        level->chunks[i].wallCount = 0;
+        level->chunks[i].wallSlots = 0;
+        level->chunks[i].wallFree = -1;
+        level->chunks[i].checkpointCount = 0;
+        level->chunks[i].checkpointSlots = 0;
+        level->chunks[i].checkpointFree = -1;
+    }
+    level->chunkCount = 0;
+    level->droppedCount = 0;
+    level->checkpointID = 0;
+}
+
+// Allocates the wall slots of a chunk that's being loaded
+static void allocateWalls(Chunk *chunk) {
+    chunk->walls = malloc(sizeof(struct Wall_t) * LEVEL_MAX_WALLS);
+    chunk->wallList = malloc(sizeof(int) * LEVEL_MAX_WALLS);
+    chunk->wallCount = 0;
+    chunk->wallSlots = 0;
+    chunk->wallFree = -1;
+}
+
+// Takes a free wall slot and lists it as active, returns -1 if the chunk is full
+static int takeWallSlot(Chunk *chunk) {
+    int slot = chunk->wallFree;
+    if (slot != -1)
+        chunk->wallFree = chunk->walls[slot].nextFree;
+    else if (chunk->wallSlots < LEVEL_MAX_WALLS)
+        slot = chunk->wallSlots++;
+    else
+        return -1;
+    chunk->wallList[chunk->wallCount++] = slot;
+    return slot;
+}
+
+static int takeCheckpointSlot(Chunk *chunk) {
+    int slot = chunk->checkpointFree;
+    if (slot != -1)
+        chunk->checkpointFree = chunk->checkpoints[slot].nextFree;
+    else if (chunk->checkpointSlots < LEVEL_MAX_CHECKPOINTS)
+        slot = chunk->checkpointSlots++;
+    else
+        return -1;
+    chunk->checkpointList[chunk->checkpointCount++] = slot;
+    return slot;
+}
+
+// Only loaded chunks can be touched by the main thread
+static bool chunkLoaded(Level *level, int index) {
+    return SDL_AtomicGet(&level->chunks[index].state) == CHUNK_LOADED;
+}
+
+// Returns the chunk at a given index, or NULL if it's past the chunk budget
+static Chunk *getChunkAtIndex(Level *level, int index) {
+    if (index < 0 || index >= LEVEL_MAX_CHUNKS) return NULL;
+    if (level->chunkCount <= index)
+        level->chunkCount = index + 1;
     return &level->chunks[index];
 }
 
@@ -64,7 +148,7 @@ static Wall *getWallsNext(Level *level, WallIterator *iter) {
         Chunk *chunk = &level->chunks[iter->chunks[iter->chunkIndex]];
         if (iter->iteratorIndex < chunk->wallCount) {
             iter->iteratorIndex++;
-            return &chunk->walls[iter->iteratorIndex - 1];
+            return &chunk->walls[chunk->wallList[iter->iteratorIndex - 1]];
         }
         iter->iteratorIndex = 0;
     }
@@ -76,7 +160,7 @@ static Checkpoint *getCheckpointNext(Level *level, CheckpointIterator *iter) {
         Chunk *chunk = &level->chunks[iter->chunks[iter->chunkIndex]];
         if (iter->iteratorIndex < chunk->checkpointCount) {
             iter->iteratorIndex++;
-            return &chunk->checkpoints[iter->iteratorIndex - 1];
+            return &chunk->checkpoints[chunk->checkpointList[iter->iteratorIndex - 1]];
         }
         iter->iteratorIndex = 0;
     }
@@ -90,12 +174,12 @@ static Wall *getWallsStart(GameState *game, Level *level, WallIterator *iter) {
     iter->iteratorIndex = 0;
     iter->chunkIndex = 0;
 
-    // Count the chunks in range of the player
-    if (chunk < level->chunkCount)
+    // Count the loaded chunks in range of the player
+    if (chunk < level->chunkCount && chunkLoaded(level, chunk))
         iter->chunks[iter->chunkCount++] = chunk;
-    if (chunk + 1 < level->chunkCount)
+    if (chunk + 1 < level->chunkCount && chunkLoaded(level, chunk + 1))
         iter->chunks[iter->chunkCount++] = chunk + 1;
-    if (chunk != 0 && level->chunkCount > 1)
+    if (chunk != 0 && chunk - 1 < level->chunkCount && chunkLoaded(level, chunk - 1))
         iter->chunks[iter->chunkCount++] = chunk - 1;
     return getWallsNext(level, iter);
 }
@@ -112,7 +196,7 @@ static Checkpoint *getCheckpointsStart(GameState *game, Level *level, Checkpoint
         iter->chunks[iter->chunkCount++] = chunk;
     if (chunk + 1 < level->chunkCount)
         iter->chunks[iter->chunkCount++] = chunk + 1;
-    if (chunk != 0 && level->chunkCount > 1)
+    if (chunk != 0 && chunk - 1 < level->chunkCount)
         iter->chunks[iter->chunkCount++] = chunk - 1;
     return getCheckpointNext(level, iter);
 }
@@ -120,27 +204,29 @@ static Checkpoint *getCheckpointsStart(GameState *game, Level *level, Checkpoint
 //******************************** Gameworld things ********************************//
 // Adds a wall to the proper chunk
 void addWall(Level *level, Wall *wall) {
-    // Get the chunk associated with this position
+    // Get the chunk associated with this position, levels that aren't streamed load chunks as they're used
     Chunk *chunk = getChunkAtPosition(level, wall->position[0], wall->position[1]);
+    if (chunk != NULL && level->levelFile == NULL && chunk->walls == NULL) {
+        allocateWalls(chunk);
+        SDL_AtomicSet(&chunk->state, CHUNK_LOADED);
+    }
+    if (chunk == NULL || SDL_AtomicGet(&chunk->state) != CHUNK_LOADED) {
+        level->droppedCount++;
+        return;
+    }
 
-    // Search for an open wall slot first
-    int spot = -1;
-    for (int i = 0; i < chunk->wallCount && spot == -1; i++)
-        if (chunk->walls[i].active == false)
-            spot = i;
-    
-    // Extend the list
+    // Take a slot if there's room in the budget
+    const int spot = takeWallSlot(chunk);
     if (spot == -1) {
-        chunk->walls = realloc(chunk->walls, (chunk->wallCount + 10) * sizeof(struct Wall_t));
-        for (int i = chunk->wallCount; i < chunk->wallCount + 10; i++)
-            chunk->walls[i].active = false;
-        spot = chunk->wallCount;
-        chunk->wallCount += 10;
+        level->droppedCount++;
+        return;
     }
 
     // Copy the wall
     chunk->walls[spot] = *wall;
     chunk->walls[spot].active = true;
+    chunk->walls[spot].chunk = chunk - level->chunks;
+    chunk->walls[spot].listIndex = chunk->wallCount - 1;
     chunk->walls[spot].startMove[0] = chunk->walls[spot].position[0];
     chunk->walls[spot].startMove[1] = chunk->walls[spot].position[1];
     chunk->walls[spot].startMove[2] = chunk->walls[spot].position[2];
@@ -152,27 +238,23 @@ void addWall(Level *level, Wall *wall) {
 void addCheckpoint(Level *level, Checkpoint *checkpoint) {
     // Get the chunk associated with this position
     Chunk *chunk = getChunkAtPosition(level, checkpoint->position[0], checkpoint->position[1]);
+    if (chunk == NULL) {
+        level->droppedCount++;
+        return;
+    }
 
-    // Search for an open wall slot first
-    int spot = -1;
-    for (int i = 0; i < chunk->checkpointCount && spot == -1; i++)
-        if (chunk->checkpoints[i].active == false)
-            spot = i;
-    
-    // Extend the list
+    // Take a slot if there's room in the budget
+    const int spot = takeCheckpointSlot(chunk);
     if (spot == -1) {
-        chunk->checkpoints = realloc(chunk->checkpoints, (chunk->checkpointCount + 10) * sizeof(struct Checkpoint_t));
-        for (int i = chunk->checkpointCount; i < chunk->checkpointCount + 10; i++)
-            chunk->checkpoints[i].active = false;
-        spot = chunk->checkpointCount;
-        chunk->checkpointCount += 10;
+        level->droppedCount++;
+        return;
     }
 
-    // Extend save chunk list
-
-    // Copy the wall
+    // Copy the checkpoint
     chunk->checkpoints[spot].playerHit = false;
     chunk->checkpoints[spot].active = true;
+    chunk->checkpoints[spot].chunk = chunk - level->chunks;
+    chunk->checkpoints[spot].listIndex = chunk->checkpointCount - 1;
     chunk->checkpoints[spot].time = 0;
     chunk->checkpoints[spot].index = level->checkpointID++;
     chunk->checkpoints[spot].position[0] = checkpoint->position[0];
@@ -180,6 +262,33 @@ void addCheckpoint(Level *level, Checkpoint *checkpoint) {
     chunk->checkpoints[spot].position[2] = checkpoint->position[2];
 }
 
+// Frees a wall's slot, the last active wall in its chunk takes its place in the chunk's list
+void removeWall(Level *level, Wall *wall) {
+    if (!wall->active)
+        return;
+    Chunk *chunk = &level->chunks[wall->chunk];
+    const int last = chunk->wallList[--chunk->wallCount];
+    chunk->wallList[wall->listIndex] = last;
+    chunk->walls[last].listIndex = wall->listIndex;
+    wall->active = false;
+    wall->nextFree = chunk->wallFree;
+    chunk->wallFree = wall - chunk->walls;
+    if (level->mostRecentWall == wall)
+        level->mostRecentWall = NULL;
+}
+
+void removeCheckpoint(Level *level, Checkpoint *checkpoint) {
+    if (!checkpoint->active)
+        return;
+    Chunk *chunk = &level->chunks[checkpoint->chunk];
+    const int last = chunk->checkpointList[--chunk->checkpointCount];
+    chunk->checkpointList[checkpoint->listIndex] = last;
+    chunk->checkpoints[last].listIndex = checkpoint->listIndex;
+    checkpoint->active = false;
+    checkpoint->nextFree = chunk->checkpointFree;
+    chunk->checkpointFree = checkpoint - chunk->checkpoints;
+}
+
 void updateCheckpoint(GameState *game, Level *level, Checkpoint *checkpoint) {
     if (!checkpoint->playerHit && glm_vec3_distance2((vec3){game->player.x, game->player.y, game->player.z}, checkpoint->position) < 1) {
         checkpoint->playerHit = true;
@@ -244,6 +353,43 @@ static void cameraControls(GameState *game) {
     camera->rotationZ = -atan2f(camera->eyes[2] - game->player.z, sqrtf(powf(camera->eyes[1] - game->player.y, 2) + pow(camera->eyes[0] - game->player.x, 2)));
 }
 
+// Walls that never move
+static bool wallIsStatic(Wall *wall) {
+    return wall->moveFactor == 0;
+}
+
+// Puts the ground in a bsp so it's drawn in order without being sorted
+static void buildGround(GameState *game, Level *level) {
+    level->bsp = trs_CreateBSP();
+
+    // Ground
+    const float z = -1;
+    for (float x = -4; x <= 4; x += 4) {
+        for (float y = -4; y <= 4; y += 4) {
+            mat4 model = GLM_MAT4_IDENTITY_INIT;
+            glm_translate(model, (vec3){x, y, z});
+            trs_BSPAddModel(level->bsp, game->groundPlane, model);
+        }
+    }
+
+    trs_BSPBuild(level->bsp);
+}
+
+// Puts a chunk's static walls in their own bsp, called by whoever loads the chunk so the loader thread
+// builds it along with the walls
+static void buildChunkGeometry(Chunk *chunk) {
+    chunk->bsp = trs_CreateBSP();
+    for (int i = 0; i < chunk->wallCount; i++) {
+        Wall *wall = &chunk->walls[chunk->wallList[i]];
+        if (wall->active && wallIsStatic(wall)) {
+            mat4 model = GLM_MAT4_IDENTITY_INIT;
+            glm_translate(model, wall->position);
+            trs_BSPAddModel(chunk->bsp, wall->model, model);
+        }
+    }
+    trs_BSPBuild(chunk->bsp);
+}
+
 bool touchingWall(GameState *game, Level *level, trs_Hitbox hitbox, float x, float y, float z) {
     WallIterator iter;
     Wall *wall = getWallsStart(game, &game->level, &iter);
@@ -260,69 +406,134 @@ bool touchingWall(GameState *game, Level *level, trs_Hitbox hitbox, float x, flo
     return false;
 }
 
-//******************************** Level loading ********************************//
-
-static float parseFloat(cJSON *num, float def) {
-    if (num != NULL && cJSON_IsNumber(num))
-        return cJSON_GetNumberValue(num);
-    return def;
+//******************************** Chunk streaming ********************************//
+// Reads a chunk's walls from the level file, whoever moved the chunk to CHUNK_LOADING owns it until then
+static void loadChunk(GameState *game, Level *level, int index) {
+    Chunk *chunk = &level->chunks[index];
+    allocateWalls(chunk);
+    const int count = levelFileLoadChunk(game, level->levelFile, index, chunk->walls, LEVEL_MAX_WALLS);
+
+    // The walls are read into the first slots
+    for (int i = 0; i < count; i++) {
+        takeWallSlot(chunk);
+        chunk->walls[i].chunk = index;
+        chunk->walls[i].listIndex = i;
+    }
+    buildChunkGeometry(chunk);
 }
 
-static void parseCoords(cJSON *list, vec3 out) {
-    if (list != NULL && cJSON_IsArray(list) && cJSON_GetArraySize(list) == 3) {
-        out[0] = parseFloat(cJSON_GetArrayItem(list, 0), 0);
-        out[1] = parseFloat(cJSON_GetArrayItem(list, 1), 0);
-        out[2] = parseFloat(cJSON_GetArrayItem(list, 2), 0);
+// Loads whatever chunks the main thread requests
+static int chunkLoaderThread(void *data) {
+    GameState *game = data;
+    Level *level = &game->level;
+    while (SDL_AtomicGet(&level->loaderRunning)) {
+        bool loaded = false;
+        for (int i = 0; i < LEVEL_MAX_CHUNKS; i++) {
+            if (SDL_AtomicCAS(&level->chunks[i].state, CHUNK_REQUESTED, CHUNK_LOADING)) {
+                loadChunk(game, level, i);
+                SDL_AtomicSet(&level->chunks[i].state, CHUNK_READY);
+                loaded = true;
+            }
+        }
+        if (!loaded)
+            SDL_Delay(CHUNK_LOADER_POLL_MS);
     }
+    return 0;
 }
 
-static bool parseWall(GameState *game, cJSON *wallJSON, Wall *wall) {
-    cJSON *type = cJSON_GetObjectItem(wallJSON, "type");
-    cJSON *position = cJSON_GetObjectItem(wallJSON, "position");
-    cJSON *finalPosition = cJSON_GetObjectItem(wallJSON, "final_position");
-    cJSON *move = cJSON_GetObjectItem(wallJSON, "move");
-    cJSON *stop = cJSON_GetObjectItem(wallJSON, "stop");
-    if (type != NULL && cJSON_IsString(type)) {
-        parseCoords(position, wall->position);
-        parseCoords(finalPosition, wall->endMove);
-        wall->stayTime = parseFloat(stop, 0);
-        wall->moveFactor = parseFloat(move, 0);
-
-        if (strcmp(cJSON_GetStringValue(type), "2x2") == 0) {
-            wall->model = game->platformModel;
-            return true;
+// Takes chunks the loader finished, makes sure the chunks around the player are loaded, requests the
+// chunk ahead of them and unloads far away chunks
+static void streamChunks(GameState *game, Level *level) {
+    if (level->levelFile == NULL)
+        return;
+    const float distance = getChunkDistance(game->player.x, game->player.y);
+    const int current = getChunkIndex(game->player.x, game->player.y);
+    const int ahead = distance >= level->chunkDistance ? current + CHUNK_PREFETCH_DISTANCE : current - CHUNK_PREFETCH_DISTANCE;
+    level->chunkDistance = distance;
+
+    for (int i = 0; i < level->chunkCount; i++) {
+        Chunk *chunk = &level->chunks[i];
+        const int away = abs(i - current);
+        SDL_AtomicCAS(&chunk->state, CHUNK_READY, CHUNK_LOADED);
+
+        if (away <= 1) {
+            // The player needs these now, one the loader hasn't started on is loaded right here and one
+            // it's in the middle of is waited for, otherwise the player could fall through its walls
+            if (SDL_AtomicCAS(&chunk->state, CHUNK_UNLOADED, CHUNK_LOADING) || SDL_AtomicCAS(&chunk->state, CHUNK_REQUESTED, CHUNK_LOADING)) {
+                loadChunk(game, level, i);
+                SDL_AtomicSet(&chunk->state, CHUNK_LOADED);
+            } else {
+                while (SDL_AtomicGet(&chunk->state) == CHUNK_LOADING)
+                    SDL_Delay(1);
+                SDL_AtomicCAS(&chunk->state, CHUNK_READY, CHUNK_LOADED);
+            }
+        } else if (i == ahead) {
+            SDL_AtomicCAS(&chunk->state, CHUNK_UNLOADED, CHUNK_REQUESTED);
+        } else if (away > CHUNK_EVICT_DISTANCE) {
+            SDL_AtomicCAS(&chunk->state, CHUNK_REQUESTED, CHUNK_UNLOADED);
+            if (chunkLoaded(level, i))
+                unloadChunk(level, i);
         }
     }
+}
+
+// Stops the loader and unloads every chunk's walls and the ground
+static void unloadLevel(Level *level) {
+    if (level->loader != NULL) {
+        SDL_AtomicSet(&level->loaderRunning, 0);
+        SDL_WaitThread(level->loader, NULL);
+        level->loader = NULL;
+    }
+    for (int i = 0; i < LEVEL_MAX_CHUNKS && level->chunks != NULL; i++)
+        if (level->chunks[i].walls != NULL)
+            unloadChunk(level, i);
+    levelFileClose(level->levelFile);
+    level->levelFile = NULL;
+    trs_FreeBSP(level->bsp);
+    level->bsp = NULL;
+}
+
+//******************************** Level loading ********************************//
+
+// Turns level objects into walls and checkpoints as the parser finishes them
+typedef struct LevelLoader_t {
+    GameState *game;
+    Level *level;
+    bool hasWalls;
+} LevelLoader;
+
+static bool parseWall(GameState *game, LevelObject *object, Wall *wall) {
+    glm_vec3_copy(object->position, wall->position);
+    glm_vec3_copy(object->finalPosition, wall->endMove);
+    wall->stayTime = object->stop;
+    wall->moveFactor = object->move;
+
+    if (strcmp(object->type, "2x2") == 0) {
+        wall->model = game->platformModel;
+        return true;
+    }
     return false;
 }
 
-// Loads a level from a csv
-bool loadLevel(GameState *game, Level *level, const char *filename) {
-    // Parse json
-    int size;
-    uint8_t *fileString = trs_LoadFile(filename, &size);
-    fileString = realloc(fileString, size + 1);
-    fileString[size] = 0;
-    cJSON *json = cJSON_Parse(fileString);
-
-    if (cJSON_HasObjectItem(json, "walls")) {
-        // Parse level
-        cJSON *wallList = cJSON_GetObjectItem(json, "walls");
-        int size = cJSON_GetArraySize(wallList);
-        
-        // Parse individual wall
-        for (int i = 0; i < size; i++) {
-            Wall wall = {0};
-            if (parseWall(game, cJSON_GetArrayItem(wallList, i), &wall))
-                addWall(level, &wall);
-        }
-    } else {
-        return false;
+static void loadLevelObject(void *data, const char *list, LevelObject *object) {
+    LevelLoader *loader = data;
+    if (strcmp(list, "walls") == 0) {
+        Wall wall = {0};
+        if (parseWall(loader->game, object, &wall))
+            addWall(loader->level, &wall);
+    } else if (strcmp(list, "checkpoints") == 0) {
+        Checkpoint checkpoint = {0};
+        glm_vec3_copy(object->position, checkpoint.position);
+        addCheckpoint(loader->level, &checkpoint);
     }
+    loader->hasWalls = loader->hasWalls || strcmp(list, "walls") == 0;
+}
 
-    cJSON_Delete(json);
-    free(fileString);
-    return true;
+// Loads a level from a json, walls are added as they're read
+bool loadLevel(GameState *game, Level *level, const char *filename) {
+    LevelLoader loader = {.game = game, .level = level};
+    const bool success = levelParse(filename, loadLevelObject, &loader);
+    return success && loader.hasWalls;
 }
 
 //******************************** Level ********************************//
@@ -334,19 +545,61 @@ void levelCreate(GameState *game) {
     camera->eyes[2] = (game->player.z + 1000);
     camera->rotation = atan2f(camera->eyes[1] - game->player.y, camera->eyes[0] - game->player.x) + GLM_PI;
     camera->rotationZ = -atan2f(camera->eyes[2] - game->player.z, sqrtf(powf(camera->eyes[1] - game->player.y, 2) + pow(camera->eyes[0] - game->player.x, 2)));
+    trs_CameraCut();
 
     // Various
     game->level.checkpointID = 0;
     game->level.startTime = game->time;
 
-    loadLevel(game, &game->level, "res/map.json");
+    // Stream the compiled level unless the json changed since it was compiled, in which case the json is
+    // compiled first and if that fails the whole json level stays loaded
+    unloadLevel(&game->level);
+    allocateChunks(&game->level);
+    const uint64_t sourceHash = levelFileHash("res/map.json");
+    game->level.levelFile = levelFileOpen("res/map.lvl", sourceHash);
+    if (game->level.levelFile == NULL) {
+        loadLevel(game, &game->level, "res/map.json");
+        if (levelFileSave(game, &game->level, "res/map.lvl", sourceHash))
+            game->level.levelFile = levelFileOpen("res/map.lvl", sourceHash);
+        else
+            fprintf(stderr, "Failed to save the compiled level.\n");
+        if (game->level.levelFile != NULL)
+            allocateChunks(&game->level); // so it's loaded from the file the same as any other launch
+    }
+    if (game->level.levelFile != NULL) {
+        const int chunkCount = levelFileChunkCount(game->level.levelFile);
+        game->level.chunkCount = chunkCount < LEVEL_MAX_CHUNKS ? chunkCount : LEVEL_MAX_CHUNKS;
+
+        // Checkpoints stay loaded the whole level
+        Checkpoint *checkpoints = malloc(sizeof(struct Checkpoint_t) * (levelFileCheckpointCount(game->level.levelFile) + 1));
+        const int count = levelFileLoadCheckpoints(game->level.levelFile, checkpoints, levelFileCheckpointCount(game->level.levelFile));
+        for (int i = 0; i < count; i++)
+            addCheckpoint(&game->level, &checkpoints[i]);
+        free(checkpoints);
+    }
     addCheckpoint(&game->level, &((Checkpoint){.position = {5, 0, 0}}));
+    if (game->level.droppedCount > 0)
+        fprintf(stderr, "%i walls/checkpoints didn't fit the level budgets.\n", game->level.droppedCount);
+
+    // Load the chunks around the player before starting the loader
+    buildGround(game, &game->level);
+    if (game->level.levelFile != NULL) {
+        game->level.chunkDistance = getChunkDistance(game->player.x, game->player.y);
+        streamChunks(game, &game->level);
+        SDL_AtomicSet(&game->level.loaderRunning, 1);
+        game->level.loader = SDL_CreateThread(chunkLoaderThread, "chunkLoader", game);
+    } else {
+        for (int i = 0; i < game->level.chunkCount; i++)
+            if (chunkLoaded(&game->level, i))
+                buildChunkGeometry(&game->level.chunks[i]);
+    }
 }
 
 void levelDestroy(GameState *game) {
-    for (int i = 0; i < game->level.chunkCount; i++) {
+    unloadLevel(&game->level);
+    for (int i = 0; i < LEVEL_MAX_CHUNKS && game->level.chunks != NULL; i++) {
         free(game->level.chunks[i].checkpoints);
-        free(game->level.chunks[i].walls);
+        free(game->level.chunks[i].checkpointList);
     }
     free(game->level.chunks);
     game->level.chunkCount = 0;
@@ -355,6 +608,7 @@ void levelDestroy(GameState *game) {
 }
 
 bool levelUpdate(GameState *game) {
+    streamChunks(game, &game->level);
     cameraControls(game);
     playerUpdate(game, &game->player);
 
@@ -364,7 +618,8 @@ bool levelUpdate(GameState *game) {
     while (wall != NULL) {
         if (wall->active) {
             updateWall(game, &game->level, wall);
-            trs_DrawModelExt(wall->model, wall->position[0], wall->position[1], wall->position[2], 1, 1, 1, 0, 0, 0);
+            if (!wallIsStatic(wall))
+                trs_DrawModelExt(wall->model, wall->position[0], wall->position[1], wall->position[2], 1, 1, 1, 0, 0, 0);
         }
         wall = getWallsNext(&game->level, &iter);
     }
@@ -384,17 +639,11 @@ bool levelUpdate(GameState *game) {
 }
 
 void levelDraw(GameState *game) {
-    // Draw some ground
-    const float z = -1;
-    trs_DrawModelExt(game->groundPlane, -4, -4, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, -4, 0, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, -4, 4, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, 0, -4, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, 0, 0, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, 0, 4, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, 4, -4, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, 4, 0, z, 1, 1, 1, 0, 0, 0);
-    trs_DrawModelExt(game->groundPlane, 4, 4, z, 1, 1, 1, 0, 0, 0);
+    // Ground and the static walls of every loaded chunk
+    trs_DrawBSP(game->level.bsp);
+    for (int i = 0; i < game->level.chunkCount; i++)
+        if (chunkLoaded(&game->level, i))
+            trs_DrawBSP(game->level.chunks[i].bsp);
     
     playerDraw(game, &game->player);
 }
@@ -429,26 +678,28 @@ void levelDrawUI(GameState *game) {
     }
     
     // Hint
-    SDL_RenderCopy(game->renderer, game->hintTex, NULL, &((SDL_Rect){.x = 0, .y = 205, .w = 81, .h = 19}));
+    trs_Batch2DImage(game->hintTex, NULL, 0, 205, 81, 19);
 
     // Draw orientation
     const float startX = 230 + 13;
     const float startY = 13;
-    SDL_RenderCopy(game->renderer, game->compassTex, NULL, &((SDL_Rect){.x = startX - 13, .y = startY - 13, .w = 25, .h = 25}));
+    trs_Batch2DImage(game->compassTex, NULL, startX - 13, startY - 13, 25, 25);
+
+    // Needles go over the compass
+    trs_Batch2DSetLayer(1);
 
     // Horizontal orientation
     const float rotation = camera->rotation - ((3 * GLM_PI) / 4);
     const float horiX = (cosf(rotation) * 10);
     const float horiY = (sinf(rotation) * 10);
-    SDL_SetRenderDrawColor(game->renderer, 255, 0, 0, 255);
-    SDL_RenderDrawLine(game->renderer, startX, startY, startX + horiX, startY + horiY);
+    trs_Batch2DLine(startX, startY, startX + horiX, startY + horiY, (SDL_Color){255, 0, 0, 255});
 
     // Vertical orientation
     const float verticalPercent = (camera->rotationZ / GLM_PI);
-    SDL_SetRenderDrawColor(game->renderer, 0, 0, 255, 255);
-    SDL_RenderDrawLine(game->renderer, startX, startY, startX, startY - (verticalPercent * 20));
-    SDL_SetRenderDrawColor(game->renderer, 0, 0, 0, 255);
-    SDL_RenderDrawPoint(game->renderer, startX, startY);
+    trs_Batch2DLine(startX, startY, startX, startY - (verticalPercent * 20), (SDL_Color){0, 0, 255, 255});
+    trs_Batch2DSetLayer(2);
+    trs_Batch2DPoint(startX, startY, (SDL_Color){0, 0, 0, 255});
+    trs_Batch2DSetLayer(0);
 }
 
 void levelDisplayMessage(GameState *game, const char *message, ...) {
@@ -8,4 +8,8 @@ void levelDraw(GameState *game);
 void levelDrawUI(GameState *game);
 void levelDisplayMessage(GameState *game, const char *message, ...);
 bool touchingWall(GameState *game, Level *level, trs_Hitbox hitbox, float x, float y, float z);
-void addWall(Level *level, Wall *wall);
\ No newline at end of file
+void addWall(Level *level, Wall *wall);
+void addCheckpoint(Level *level, Checkpoint *checkpoint);
+// Removing a wall or checkpoint while iterating over its chunk skips the one that takes its place
+void removeWall(Level *level, Wall *wall);
+void removeCheckpoint(Level *level, Checkpoint *checkpoint);
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include "Software3D.h"
+#include "LevelFile.h"
+
+//******************************** Format ********************************//
+// A header, the number of walls in each chunk, every wall grouped by chunk and then every checkpoint in
+// the order they were added. Everything is in native byte order since the game compiles the file itself
+// from the json it ships with.
+#define LEVEL_FILE_VERSION 2
+static const char LEVEL_FILE_MAGIC[4] = {'T', 'R', 'S', 'L'};
+
+typedef struct LevelFileHeader_t {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash; // of the json it was compiled from
+    uint32_t chunkCount;
+    uint32_t wallCount;
+    uint32_t checkpointCount;
+} LevelFileHeader;
+
+typedef struct LevelFileWall_t {
+    float position[3];
+    float endMove[3];
+    float moveFactor;
+    float stayTime;
+    int32_t model; // index from levelFileModel
+} LevelFileWall;
+
+typedef struct LevelFileCheckpoint_t {
+    float position[3];
+} LevelFileCheckpoint;
+
+// Models a wall can use, the model and hitbox of a wall are saved as an index in here
+static trs_Model levelFileModel(GameState *game, int index) {
+    switch (index) {
+        case 0: return game->platformModel;
+        default: return NULL;
+    }
+}
+
+static int levelFileModelIndex(GameState *game, trs_Model model) {
+    for (int i = 0; levelFileModel(game, i) != NULL; i++)
+        if (levelFileModel(game, i) == model)
+            return i;
+    return -1;
+}
+
+//******************************** Saving/loading ********************************//
+uint64_t levelFileHash(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return 0;
+    uint64_t hash = 14695981039346656037ull; // fnv-1a
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        for (size_t i = 0; i < read; i++)
+            hash = (hash ^ buffer[i]) * 1099511628211ull;
+    fclose(file);
+    return hash;
+}
+
+static int levelFileCheckpointComp(const void *a, const void *b) {
+    return (*(Checkpoint**)a)->index - (*(Checkpoint**)b)->index;
+}
+
+bool levelFileSave(GameState *game, Level *level, const char *filename, uint64_t sourceHash) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL)
+        return false;
+
+    // Count what can be saved first, walls with models that aren't in the table can't be
+    uint32_t *chunkWalls = calloc(level->chunkCount + 1, sizeof(uint32_t));
+    LevelFileHeader header = {.version = LEVEL_FILE_VERSION, .sourceHash = sourceHash, .chunkCount = level->chunkCount};
+    memcpy(header.magic, LEVEL_FILE_MAGIC, 4);
+    for (int i = 0; i < level->chunkCount; i++) {
+        for (int j = 0; j < level->chunks[i].wallCount; j++) {
+            Wall *wall = &level->chunks[i].walls[level->chunks[i].wallList[j]];
+            if (wall->active && levelFileModelIndex(game, wall->model) != -1)
+                chunkWalls[i]++;
+            else if (wall->active)
+                fprintf(stderr, "Wall in chunk %i has a model levels can't save.\n", i);
+        }
+        header.wallCount += chunkWalls[i];
+        header.checkpointCount += level->chunks[i].checkpointCount;
+    }
+    fwrite(&header, sizeof(LevelFileHeader), 1, file);
+    fwrite(chunkWalls, sizeof(uint32_t), level->chunkCount, file);
+
+    // Walls in chunk order
+    for (int i = 0; i < level->chunkCount; i++) {
+        for (int j = 0; j < level->chunks[i].wallCount; j++) {
+            Wall *wall = &level->chunks[i].walls[level->chunks[i].wallList[j]];
+            const int model = levelFileModelIndex(game, wall->model);
+            if (wall->active && model != -1) {
+                LevelFileWall out = {
+                    .position = {wall->startMove[0], wall->startMove[1], wall->startMove[2]},
+                    .endMove = {wall->endMove[0], wall->endMove[1], wall->endMove[2]},
+                    .moveFactor = wall->moveFactor,
+                    .stayTime = wall->stayTime,
+                    .model = model
+                };
+                fwrite(&out, sizeof(LevelFileWall), 1, file);
+            }
+        }
+    }
+
+    // Checkpoints by index so they get the same indices when they're loaded
+    Checkpoint **checkpoints = malloc(sizeof(Checkpoint*) * (header.checkpointCount + 1));
+    int checkpointCount = 0;
+    for (int i = 0; i < level->chunkCount; i++)
+        for (int j = 0; j < level->chunks[i].checkpointCount; j++)
+            checkpoints[checkpointCount++] = &level->chunks[i].checkpoints[level->chunks[i].checkpointList[j]];
+    qsort(checkpoints, checkpointCount, sizeof(Checkpoint*), levelFileCheckpointComp);
+    for (int i = 0; i < checkpointCount; i++) {
+        LevelFileCheckpoint out = {.position = {checkpoints[i]->position[0], checkpoints[i]->position[1], checkpoints[i]->position[2]}};
+        fwrite(&out, sizeof(LevelFileCheckpoint), 1, file);
+    }
+
+    free(checkpoints);
+    free(chunkWalls);
+    const bool success = ferror(file) == 0;
+    fclose(file);
+    return success;
+}
+
+//******************************** Streaming ********************************//
+// Where every chunk's walls are in the file so they can be read one chunk at a time
+struct LevelFileIndex_t {
+    FILE *file;
+    SDL_mutex *lock; // the loader thread and main thread both read chunks
+    uint32_t chunkCount;
+    uint32_t *chunkWalls;
+    long *chunkOffsets; // of each chunk's first wall
+    uint32_t checkpointCount;
+    long checkpointOffset;
+};
+
+LevelFileIndex levelFileOpen(const char *filename, uint64_t sourceHash) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    rewind(file);
+
+    // Make sure everything it claims to have is there
+    LevelFileHeader header;
+    bool valid = fread(&header, sizeof(LevelFileHeader), 1, file) == 1 && memcmp(header.magic, LEVEL_FILE_MAGIC, 4) == 0 &&
+                 header.version == LEVEL_FILE_VERSION && (sourceHash == 0 || header.sourceHash == sourceHash) &&
+                 size == (long)(sizeof(LevelFileHeader) + (sizeof(uint32_t) * header.chunkCount) + (sizeof(LevelFileWall) * header.wallCount) +
+                                (sizeof(LevelFileCheckpoint) * header.checkpointCount));
+    uint32_t *chunkWalls = valid ? malloc(sizeof(uint32_t) * (header.chunkCount + 1)) : NULL;
+    valid = valid && fread(chunkWalls, sizeof(uint32_t), header.chunkCount, file) == header.chunkCount;
+    uint64_t total = 0;
+    for (uint32_t i = 0; valid && i < header.chunkCount; i++)
+        total += chunkWalls[i];
+    if (!valid || total != header.wallCount) {
+        free(chunkWalls);
+        fclose(file);
+        return NULL;
+    }
+
+    LevelFileIndex index = malloc(sizeof(struct LevelFileIndex_t));
+    index->file = file;
+    index->lock = SDL_CreateMutex();
+    index->chunkCount = header.chunkCount;
+    index->chunkWalls = chunkWalls;
+    index->chunkOffsets = malloc(sizeof(long) * (header.chunkCount + 1));
+    long offset = sizeof(LevelFileHeader) + (sizeof(uint32_t) * header.chunkCount);
+    for (uint32_t i = 0; i < header.chunkCount; i++) {
+        index->chunkOffsets[i] = offset;
+        offset += sizeof(LevelFileWall) * chunkWalls[i];
+    }
+    index->checkpointCount = header.checkpointCount;
+    index->checkpointOffset = offset;
+    return index;
+}
+
+int levelFileChunkCount(LevelFileIndex index) {
+    return index->chunkCount;
+}
+
+int levelFileLoadChunk(GameState *game, LevelFileIndex index, int chunk, Wall *walls, int maxWalls) {
+    if (chunk < 0 || chunk >= (int)index->chunkCount)
+        return 0;
+    SDL_LockMutex(index->lock);
+    if (fseek(index->file, index->chunkOffsets[chunk], SEEK_SET) != 0) {
+        SDL_UnlockMutex(index->lock);
+        return 0;
+    }
+
+    // Walls with models that aren't in the table are skipped
+    int count = 0;
+    LevelFileWall in;
+    for (uint32_t i = 0; i < index->chunkWalls[chunk] && count < maxWalls; i++) {
+        if (fread(&in, sizeof(LevelFileWall), 1, index->file) != 1)
+            break;
+        trs_Model model = in.model >= 0 ? levelFileModel(game, in.model) : NULL;
+        if (model == NULL)
+            continue;
+        Wall *wall = &walls[count++];
+        *wall = (Wall){0};
+        wall->active = true;
+        memcpy(wall->position, in.position, sizeof(vec3));
+        memcpy(wall->startMove, in.position, sizeof(vec3));
+        memcpy(wall->endMove, in.endMove, sizeof(vec3));
+        wall->moveFactor = in.moveFactor;
+        wall->stayTime = in.stayTime;
+        wall->model = model;
+        wall->hitbox = trs_GetModelHitbox(wall->model);
+    }
+    SDL_UnlockMutex(index->lock);
+    return count;
+}
+
+int levelFileLoadCheckpoints(LevelFileIndex index, Checkpoint *checkpoints, int maxCheckpoints) {
+    SDL_LockMutex(index->lock);
+    int count = 0;
+    LevelFileCheckpoint in;
+    if (fseek(index->file, index->checkpointOffset, SEEK_SET) == 0) {
+        for (uint32_t i = 0; i < index->checkpointCount && count < maxCheckpoints; i++) {
+            if (fread(&in, sizeof(LevelFileCheckpoint), 1, index->file) != 1)
+                break;
+            checkpoints[count] = (Checkpoint){0};
+            memcpy(checkpoints[count++].position, in.position, sizeof(vec3));
+        }
+    }
+    SDL_UnlockMutex(index->lock);
+    return count;
+}
+
+int levelFileCheckpointCount(LevelFileIndex index) {
+    return index->checkpointCount;
+}
+
+void levelFileClose(LevelFileIndex index) {
+    if (index != NULL) {
+        fclose(index->file);
+        SDL_DestroyMutex(index->lock);
+        free(index->chunkWalls);
+        free(index->chunkOffsets);
+        free(index);
+    }
+}
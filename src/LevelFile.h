@@ -0,0 +1,21 @@
+#include "Structs.h"
+#pragma once
+
+// Compiled levels, the walls of a json level already split into chunks with their models as indices
+// and its checkpoints
+uint64_t levelFileHash(const char *filename); // of a file's contents, 0 if it can't be read
+bool levelFileSave(GameState *game, Level *level, const char *filename, uint64_t sourceHash);
+
+// Open compiled levels, chunks are read from the file one at a time as they're needed
+typedef struct LevelFileIndex_t *LevelFileIndex;
+// Returns NULL if the file is missing, malformed or was compiled from a source with a different hash,
+// a sourceHash of 0 accepts any
+LevelFileIndex levelFileOpen(const char *filename, uint64_t sourceHash);
+int levelFileChunkCount(LevelFileIndex index);
+// Reads up to maxWalls walls of a chunk into walls and returns how many were read, safe to call from
+// any thread
+int levelFileLoadChunk(GameState *game, LevelFileIndex index, int chunk, Wall *walls, int maxWalls);
+int levelFileCheckpointCount(LevelFileIndex index);
+// Reads up to maxCheckpoints checkpoint positions in the order they were added, returns how many were read
+int levelFileLoadCheckpoints(LevelFileIndex index, Checkpoint *checkpoints, int maxCheckpoints);
+void levelFileClose(LevelFileIndex index);
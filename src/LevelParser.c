@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include "LevelParser.h"
+
+//******************************** Reading ********************************//
+// The file is read a buffer at a time as the parser needs it so only one buffer is ever in memory
+#define LEVEL_PARSER_MAX_DEPTH 64
+
+typedef struct LevelParser_t {
+    FILE *file;
+    char buffer[LEVEL_PARSER_BUFFER_SIZE];
+    size_t size;
+    size_t index;
+    int depth; // of values being skipped
+    bool error;
+    LevelObjectCallback callback;
+    void *data;
+} LevelParser;
+
+// Returns the next character without taking it, or EOF at the end of the file
+static int peekChar(LevelParser *parser) {
+    if (parser->index == parser->size) {
+        parser->size = fread(parser->buffer, 1, LEVEL_PARSER_BUFFER_SIZE, parser->file);
+        parser->index = 0;
+        if (parser->size == 0)
+            return EOF;
+    }
+    return (unsigned char)parser->buffer[parser->index];
+}
+
+static int nextChar(LevelParser *parser) {
+    const int c = peekChar(parser);
+    if (c != EOF)
+        parser->index++;
+    return c;
+}
+
+static void skipSpace(LevelParser *parser) {
+    int c = peekChar(parser);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+        parser->index++;
+        c = peekChar(parser);
+    }
+}
+
+// Takes the next non-whitespace character if it's c, otherwise flags an error
+static bool expectChar(LevelParser *parser, char c) {
+    skipSpace(parser);
+    if (!parser->error && nextChar(parser) == c)
+        return true;
+    parser->error = true;
+    return false;
+}
+
+// Returns true and takes c if it's the next non-whitespace character
+static bool acceptChar(LevelParser *parser, char c) {
+    skipSpace(parser);
+    if (peekChar(parser) == c) {
+        parser->index++;
+        return true;
+    }
+    return false;
+}
+
+//******************************** Values ********************************//
+static void skipValue(LevelParser *parser);
+
+// Reads a string into out, anything past size - 1 characters is dropped
+static void parseString(LevelParser *parser, char *out, int size) {
+    int length = 0;
+    if (!expectChar(parser, '"'))
+        return;
+    int c = nextChar(parser);
+    while (c != '"' && c != EOF) {
+        if (c == '\\') {
+            c = nextChar(parser);
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'u': // Level names are ascii, anything else is replaced
+                    for (int i = 0; i < 4; i++)
+                        nextChar(parser);
+                    c = '?';
+                    break;
+                default: break; // \" \\ and \/ are themselves
+            }
+        }
+        if (length < size - 1)
+            out[length++] = c;
+        c = nextChar(parser);
+    }
+    if (c == EOF)
+        parser->error = true;
+    out[length] = 0;
+}
+
+static float parseNumber(LevelParser *parser) {
+    char number[64];
+    int length = 0;
+    skipSpace(parser);
+    int c = peekChar(parser);
+    while ((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+        if (length < (int)sizeof(number) - 1)
+            number[length++] = c;
+        parser->index++;
+        c = peekChar(parser);
+    }
+    number[length] = 0;
+    char *end;
+    const float out = strtod(number, &end);
+    if (length == 0 || *end != 0)
+        parser->error = true;
+    return out;
+}
+
+static bool isNumber(LevelParser *parser) {
+    skipSpace(parser);
+    const int c = peekChar(parser);
+    return (c >= '0' && c <= '9') || c == '-';
+}
+
+// Skips over an object or array and everything inside of it
+static void skipContainer(LevelParser *parser, char open, char close) {
+    if (++parser->depth > LEVEL_PARSER_MAX_DEPTH)
+        parser->error = true;
+    expectChar(parser, open);
+    if (!parser->error && !acceptChar(parser, close)) {
+        do {
+            if (open == '{') {
+                char key[LEVEL_PARSER_NAME_SIZE];
+                parseString(parser, key, LEVEL_PARSER_NAME_SIZE);
+                expectChar(parser, ':');
+            }
+            skipValue(parser);
+        } while (!parser->error && acceptChar(parser, ','));
+        expectChar(parser, close);
+    }
+    parser->depth--;
+}
+
+static void skipLiteral(LevelParser *parser, const char *literal) {
+    for (int i = 0; literal[i] != 0 && !parser->error; i++)
+        if (nextChar(parser) != literal[i])
+            parser->error = true;
+}
+
+static void skipValue(LevelParser *parser) {
+    skipSpace(parser);
+    if (parser->error)
+        return;
+    char string[LEVEL_PARSER_NAME_SIZE];
+    switch (peekChar(parser)) {
+        case '{': skipContainer(parser, '{', '}'); break;
+        case '[': skipContainer(parser, '[', ']'); break;
+        case '"': parseString(parser, string, LEVEL_PARSER_NAME_SIZE); break;
+        case 't': skipLiteral(parser, "true"); break;
+        case 'f': skipLiteral(parser, "false"); break;
+        case 'n': skipLiteral(parser, "null"); break;
+        default: parseNumber(parser); break;
+    }
+}
+
+// Numbers replace out, anything else is skipped
+static void parseFloat(LevelParser *parser, float *out) {
+    if (isNumber(parser))
+        *out = parseNumber(parser);
+    else
+        skipValue(parser);
+}
+
+// Only lists of exactly 3 elements replace out, elements that aren't numbers are 0
+static void parseCoords(LevelParser *parser, vec3 out) {
+    skipSpace(parser);
+    if (peekChar(parser) != '[') {
+        skipValue(parser);
+        return;
+    }
+    vec3 coords = {0};
+    int count = 0;
+    expectChar(parser, '[');
+    if (!acceptChar(parser, ']')) {
+        do {
+            float value = 0;
+            parseFloat(parser, &value);
+            if (count < 3)
+                coords[count] = value;
+            count++;
+        } while (!parser->error && acceptChar(parser, ','));
+        expectChar(parser, ']');
+    }
+    if (count == 3)
+        glm_vec3_copy(coords, out);
+}
+
+//******************************** Level ********************************//
+// An object in a list, given to the callback once its closing brace is read
+static void parseObject(LevelParser *parser, const char *list) {
+    LevelObject object = {0};
+    expectChar(parser, '{');
+    if (!parser->error && !acceptChar(parser, '}')) {
+        do {
+            char key[LEVEL_PARSER_NAME_SIZE];
+            parseString(parser, key, LEVEL_PARSER_NAME_SIZE);
+            expectChar(parser, ':');
+            skipSpace(parser);
+            if (parser->error)
+                return;
+            if (strcmp(key, "type") == 0 && peekChar(parser) == '"')
+                parseString(parser, object.type, LEVEL_PARSER_NAME_SIZE);
+            else if (strcmp(key, "position") == 0)
+                parseCoords(parser, object.position);
+            else if (strcmp(key, "final_position") == 0)
+                parseCoords(parser, object.finalPosition);
+            else if (strcmp(key, "move") == 0)
+                parseFloat(parser, &object.move);
+            else if (strcmp(key, "stop") == 0)
+                parseFloat(parser, &object.stop);
+            else
+                skipValue(parser);
+        } while (!parser->error && acceptChar(parser, ','));
+        expectChar(parser, '}');
+    }
+    if (!parser->error)
+        parser->callback(parser->data, list, &object);
+}
+
+// Lists of objects, anything else at the top of the level is skipped
+static void parseList(LevelParser *parser, const char *list) {
+    skipSpace(parser);
+    if (peekChar(parser) != '[') {
+        skipValue(parser);
+        return;
+    }
+    expectChar(parser, '[');
+    if (!acceptChar(parser, ']')) {
+        do {
+            skipSpace(parser);
+            if (peekChar(parser) == '{')
+                parseObject(parser, list);
+            else
+                skipValue(parser);
+        } while (!parser->error && acceptChar(parser, ','));
+        expectChar(parser, ']');
+    }
+}
+
+bool levelParse(const char *filename, LevelObjectCallback callback, void *data) {
+    LevelParser *parser = malloc(sizeof(struct LevelParser_t));
+    *parser = (LevelParser){.callback = callback, .data = data};
+    parser->file = fopen(filename, "rb");
+    if (parser->file == NULL) {
+        free(parser);
+        return false;
+    }
+
+    expectChar(parser, '{');
+    if (!parser->error && !acceptChar(parser, '}')) {
+        do {
+            char list[LEVEL_PARSER_NAME_SIZE];
+            parseString(parser, list, LEVEL_PARSER_NAME_SIZE);
+            expectChar(parser, ':');
+            if (!parser->error)
+                parseList(parser, list);
+        } while (!parser->error && acceptChar(parser, ','));
+        expectChar(parser, '}');
+    }
+    skipSpace(parser);
+    const bool success = !parser->error && peekChar(parser) == EOF;
+
+    fclose(parser->file);
+    free(parser);
+    return success;
+}
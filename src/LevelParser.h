@@ -0,0 +1,23 @@
+#include "Structs.h"
+#pragma once
+
+// Streams a json level through a fixed size buffer, handing over each object in the level's lists
+// as soon as it's closed instead of building the whole document first
+#define LEVEL_PARSER_BUFFER_SIZE 4096
+#define LEVEL_PARSER_NAME_SIZE 32
+
+// Every field an object in a level list can have, fields an object doesn't have keep their defaults
+typedef struct LevelObject_t {
+    char type[LEVEL_PARSER_NAME_SIZE]; // empty if it has no type
+    vec3 position;
+    vec3 finalPosition;
+    float move;
+    float stop;
+} LevelObject;
+
+// list is the key of the list the object is in, like "walls" or "checkpoints"
+typedef void (*LevelObjectCallback)(void *data, const char *list, LevelObject *object);
+
+// Returns false if the file is missing or isn't valid json, objects before the error have already
+// been given to the callback
+bool levelParse(const char *filename, LevelObjectCallback callback, void *data);
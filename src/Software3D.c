@@ -6,11 +6,17 @@
 #include <SDL2/SDL_syswm.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <float.h>
 #include "stb_image.h"
 #include "tinyobj_loader_c.h"
 #include "cute_sound.h"
 #include "Software3D.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRS_RASTER_SSE
+#endif
+
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
 Uint32 rmask = 0xff000000;
 Uint32 gmask = 0x00ff0000;
@@ -24,6 +30,44 @@ Uint32 amask = 0xff000000;
 #endif
 
 //----------------- CONSTANTS -----------------//
+#define TRS_ATLAS_PAGE_SIZE 512 // width and height of each atlas page
+#define TRS_ATLAS_PADDING 1 // gutter around each packed image, filled with the image's edge pixels
+#define TRS_TILE_SIZE 16 // software rasterizer tiles are TRS_TILE_SIZE*TRS_TILE_SIZE pixels
+#define TRS_MAX_RASTER_THREADS 8
+#define TRS_CLEAR_COLOUR 0xffffffff // white, same as the SDL backend
+#define TRS_OCCLUSION_WIDTH 64 // resolution of the occlusion depth buffer
+#define TRS_OCCLUSION_HEIGHT 56
+#define TRS_SORT_CUT_DISTANCE 8 // camera movement in a frame that counts as a cut for the temporal sort
+#define TRS_SORT_CUT_ANGLE 0.5
+#define TRS_SORT_MOVE_LIMIT 8 // average insertion sort shifts per triangle before giving up on the last order
+#define TRS_BSP_EPSILON 0.001f // distance from a plane that still counts as on it
+#define TRS_BSP_CANDIDATES 16 // splitters tried per node
+#define TRS_ARENA_ALIGN 16
+#define TRS_FRAME_ARENA_SIZE (1024 * 1024) // starting size, it grows to whatever the biggest frame needs
+#define TRS_NEAR_PLANE 0.1f
+#define TRS_FAR_PLANE 100.0f // default base far plane
+#define TRS_FOG_START 0.7f // fraction of the far plane fog starts at
+#define TRS_GOVERNOR_LEVELS 5
+#define TRS_GOVERNOR_SLOW 1.1 // average frame time over target * this counts as slow
+#define TRS_GOVERNOR_FAST 0.8 // and under target * this as fast
+#define TRS_GOVERNOR_DOWN_FRAMES 15 // slow frames in a row before dropping a level
+#define TRS_GOVERNOR_UP_FRAMES 120 // fast frames in a row before going back up
+#define TRS_SORT_DIRECTIONS 14 // view directions each model has a precomputed triangle order for
+#define TRS_AUDIO_FREQUENCY 44100 // default mixing rate
+#define TRS_AUDIO_DEVICE_FRAMES 256 // frames the device asks the mixer for at a time
+#define TRS_AUDIO_MIN_LATENCY 512 // frames the automatic mixer queue starts at
+#define TRS_AUDIO_MAX_LATENCY 8192 // and the most it grows to, the mixer's buffers are sized for at least this
+#define TRS_AUDIO_RING_FRAMES 65536 // per channel in a stream's ring buffer, about a second and a half at 44.1khz
+#define TRS_AUDIO_CHUNK_FRAMES 4096 // frames a stream reads from disk at once
+#define TRS_AUDIO_GUARD_FRAMES 16 // kept free behind the mixer's cursor, it reads from 4-frame aligned positions
+#define TRS_AUDIO_POLL_MS 10 // how often stream readers check the mixer's cursor
+
+// Triangle streams, everything but the sorted stream is already in back to front order
+#define TRS_STREAM_SORTED 0
+#define TRS_STREAM_INSTANCES 1
+#define TRS_STREAM_BSP 2 // the first bsp drawn in a frame, each one after it is the next stream
+#define TRS_HASH_OFFSET 14695981039346656037ull // fnv-1a
+#define TRS_HASH_PRIME 1099511628211ull
 #define trs_CheckReturn(f) _trs_CheckReturn(f, __LINE__)
 #define trs_Assert(f) _trs_Assert(f, __LINE__)
 #define trs_CheckMem(f) _trs_CheckMem(f, __LINE__)
@@ -31,6 +75,177 @@ Uint32 amask = 0xff000000;
 
 //----------------- STRUCTS -----------------//
 
+typedef struct trs_MaterialTexture_t {
+    char *filename;
+    trs_Image image;
+} trs_MaterialTexture;
+
+// A model drawn this frame, expanded into triangles in trs_EndFrame if it survives culling
+typedef struct trs_Instance_t {
+    mat4 matrix;
+    trs_Model model;
+} trs_Instance;
+
+// CPU copy of a texture for the software rasterizer
+typedef struct trs_TexturePixels_t {
+    SDL_Texture *texture;
+    uint32_t *pixels; // RGBA
+    int w;
+    int h;
+} trs_TexturePixels;
+
+// A screen-space triangle ready for rasterizing
+typedef struct trs_RasterTriangle_t {
+    float a[3], b[3], c[3]; // edge functions a*x + b*y + c, edge i is opposite vertex i and positive inside
+    vec3 z; // ndc depth of each vertex
+    vec3 invW; // 1/w, u/w and v/w are interpolated for perspective correct uvs
+    vec3 uOverW;
+    vec3 vOverW;
+    float invArea;
+    int minX, minY, maxX, maxY; // inclusive screen bounds
+    const trs_TexturePixels *texture;
+} trs_RasterTriangle;
+
+typedef struct trs_Rasterizer_t {
+    SDL_Texture *texture; // streaming texture frames are rasterized into
+    float *depth;
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+
+    // Per-frame triangles and the tiles they touch
+    trs_RasterTriangle *triangles;
+    int triangleCount; // triangles and bins are in the frame arena
+    int triangleSize;
+    int *binStarts; // tilesX*tilesY + 1 offsets into bins
+    int *bins; // triangle indices, grouped by tile
+    float fogStart; // view depths, fog blends towards the clear colour
+    float fogEnd;
+
+    // Locked texture for this frame
+    uint32_t *pixels;
+    int pitch; // in pixels
+
+    // Workers
+    SDL_Thread *threads[TRS_MAX_RASTER_THREADS];
+    int threadCount;
+    SDL_sem *start;
+    SDL_sem *done;
+    SDL_atomic_t nextTile;
+    bool quit;
+} trs_Rasterizer;
+
+typedef struct trs_BSPTriangle_t {
+    trs_Vertex vertices[3]; // world space, uvs are relative to the texture
+    trs_Image texture; // NULL for the global texture
+    trs_CullMode cullMode;
+    bool occluder; // from a model marked as an occluder when it was added
+} trs_BSPTriangle;
+
+typedef struct trs_BSPNode_t {
+    vec4 plane; // normal and distance
+    int first; // triangles lying on the plane
+    int count;
+    int front; // child nodes, -1 for none
+    int back;
+} trs_BSPNode;
+
+struct trs_BSP_t {
+    trs_BSPTriangle *input; // triangles added since creation
+    int inputCount;
+    int inputSize;
+    trs_BSPTriangle *triangles; // split triangles grouped by node
+    int triangleCount;
+    int triangleSize;
+    trs_BSPNode *nodes;
+    int nodeCount;
+    int nodeSize;
+    int root;
+};
+
+typedef struct trs_Batch2DItem_t {
+    SDL_Texture *texture;
+    int layer;
+    int order; // submission order, keeps the texture sort stable
+    SDL_Vertex vertices[4];
+} trs_Batch2DItem;
+
+typedef struct trs_Batch2D_t {
+    trs_Batch2DItem *items; // in the frame arena
+    int count;
+    int size;
+    SDL_Vertex *vertices; // flattened items for the flush, in the frame arena
+    int *indices; // two triangles per quad, shared between every run
+    int vertexSize; // number of quads the index buffer has room for
+    int layer; // layer new items are put on
+} trs_Batch2D;
+
+typedef struct trs_ArenaBlock_t {
+    struct trs_ArenaBlock_t *next;
+} trs_ArenaBlock;
+
+struct trs_Arena_t {
+    uint8_t *memory;
+    size_t size;
+    size_t used;
+    trs_ArenaBlock *overflow; // allocations that didn't fit, freed on reset
+    size_t overflowUsed;
+    int overflowCount; // allocations that ever missed the arena
+    size_t highWater;
+};
+
+struct trs_Sound_t {
+    cs_audio_source_t *source;
+    int priority; // higher steals voices from lower
+    int maxInstances; // 0 for no limit
+};
+
+// A sound playing through the voice manager
+typedef struct trs_Voice_t {
+    trs_Sound sound;
+    cs_playing_sound_t playing;
+    float volume; // what it's mixed at, after distance for positional voices
+    float baseVolume;
+    bool looping;
+    Uint64 order; // lower started earlier, it's also the voice's trs_VoiceID
+    bool positional;
+    vec3 position;
+    float radius; // past it the voice goes virtual
+    bool virtual; // paused and not mixed, its cursor moves with the clock instead
+    int virtualIndex; // sample index when it went virtual
+    Uint64 virtualSince; // performance counter when it went virtual
+} trs_Voice;
+
+// A wav streamed from disk through a ring buffer the mixer plays as a looping sound
+struct trs_Stream_t {
+    SDL_RWops *file;
+    Sint64 dataStart; // file offset of the samples
+    int frames; // samples per channel in the file
+    int channels;
+    int sampleRate;
+    int16_t *chunk; // TRS_AUDIO_CHUNK_FRAMES of file data
+    cs_audio_source_t *ring; // TRS_AUDIO_RING_FRAMES long
+    cs_playing_sound_t playing;
+    SDL_Thread *thread; // reader, only while playing
+    SDL_atomic_t running;
+    bool looping;
+    int fileFrame; // next frame to read from the file
+    int64_t written; // frames written to the ring since playback started
+    int64_t played; // frames the mixer has gone through
+    int lastIndex; // mixer's cursor in the ring at the last poll
+    int64_t end; // written count the file ran out at, -1 until then
+};
+
+typedef struct trs_Governor_t {
+    double targetFrameTime; // seconds, 0 when the governor is off
+    double averageFrameTime; // exponential moving average
+    Uint64 lastFrame; // performance counter at the last trs_BeginFrame
+    int level; // 0 is full quality
+    int framesSlow; // frames in a row the average has been over the target
+    int framesFast;
+} trs_Governor;
+
 struct trs_GameState_t {
     trs_TriangleList triangleList;
     trs_TriangleList backbuffer; // for processing on the backend
@@ -41,10 +256,72 @@ struct trs_GameState_t {
     double delta; // Difference in time between frames
     mat4 perspective; // Perspective matrix
     SDL_Window *window;
-    SDL_Texture *target;
-    float logicalWidth;
+    SDL_Texture *target; // logical size, the 3D is stretched onto it and the ui drawn over that
+    SDL_Texture *renderTarget; // 3D at the render resolution, the target itself at the logical resolution
+    float logicalWidth; // size the ui is drawn at and trs_EndFrame reports
     float logicalHeight;
-    SDL_Texture *uvtexture; // texture all the models will pull from, "textures.png"
+    float renderWidth; // 3D resolution asked for with trs_SetResolution
+    float renderHeight;
+    int targetWidth; // actual size of the render target, the render resolution after the governor
+    int targetHeight;
+    bool governorResolution; // let the governor scale the render resolution too
+    trs_Image uvtexture; // texture all the models will pull from, "textures.png"
+    trs_Image whiteImage; // 1x1 white image so coloured 2D geometry can share the batch
+    trs_MaterialTexture *materialTextures; // textures loaded for model materials
+    int materialTextureCount;
+    int textureSortBuckets; // depth buckets to group textures in, 0 to keep the exact painter's order
+    trs_Instance *instances;
+    int instanceCount;
+    int instanceSize;
+    float *occlusionDepth; // TRS_OCCLUSION_WIDTH*TRS_OCCLUSION_HEIGHT, occluders' furthest ndc depth
+    int occludedCount; // instances culled last frame
+    trs_Backend backend;
+    trs_Rasterizer rasterizer;
+    trs_TexturePixels *texturePixels; // CPU copies of the textures the rasterizer might sample
+    int texturePixelCount;
+    trs_Image *images; // every image alive, for packing into the atlas
+    int imageCount;
+    int imageSize;
+    SDL_Texture **atlasPages;
+    int atlasPageCount;
+    trs_Batch2D batch; // queued 2D geometry for the UI pass
+    bool temporalSort; // start the painter's sort from the previous frame's order
+    bool cameraCut; // forces the next temporal sort to start from scratch
+    trs_Camera sortCamera; // camera the previous order was sorted for
+    int triangleIdCount; // stable ids handed out this frame, in draw order
+    int *sortOrder; // previous frame's painter's order as triangle ids, or instances' first triangle ids in instance mode
+    int sortOrderCount;
+    int sortOrderSize;
+    int fullSortCount; // frames the temporal sort fell back to a full sort
+    trs_BSP *bsps; // static geometry drawn this frame
+    int bspCount;
+    int bspSize;
+    trs_SortMode sortMode;
+    trs_Arena frameArena; // scratch memory for the frame, reset by trs_BeginFrame
+    trs_Config config;
+    trs_BudgetStats budgetStats;
+    trs_Governor governor;
+    float farPlane; // before the governor scales it
+    float lodBias; // multiplies instance distances when picking lods
+    bool fog;
+    float fogStart; // view depths for this frame, equal when there's no fog
+    float fogEnd;
+    bool frameReuse; // hand back the last frame when nothing that's drawn changed
+    bool frameValid; // the last frame finished and can be reused
+    uint64_t frameHash; // of everything the last frame was drawn from
+    SDL_atomic_t frameGeneration; // bumped by anything that changes how the same scene is drawn
+    SDL_Texture *frameCache; // copy of the sdl backend's 3D before the ui is drawn over it, when they share the target
+    int reusedFrames;
+    trs_Voice *voices; // sounds trs_PlaySound started that might still be playing
+    int voiceCount;
+    int voiceSize;
+    Uint64 voiceOrder;
+    trs_AudioStats audioStats;
+    int audioLatency; // frames the mixer keeps queued for the device
+    int audioMaxLatency; // what the mixer's buffers can hold
+    bool audioAutoLatency; // grow the queue whenever the device underruns
+    SDL_atomic_t audioUnderruns; // times the device asked for more than was mixed
+    int audioUnderrunsSeen; // underruns the automatic latency has already reacted to
 };
 
 typedef struct trs_GameState_t *trs_GameState;
@@ -54,15 +331,33 @@ static trs_GameState gGameState;
 static int gTriangleCount;
 static int gTinyOBJSize;
 static void *gTinyOBJBuffer;
+static int gTinyMTLSize;
+static void *gTinyMTLBuffer;
 static cs_context_t *gCuteSound;
 
 typedef struct trs_TriangleDepth_t {
     int index;
+    int id;
     float averageDepth;
     float lowestDepth;
+    SDL_Texture *texture;
+    int bucket; // for texture bucket sorting
+    int order;
 } trs_TriangleDepth;
 
+// Directions each model's triangles are presorted for, the 6 axes and 8 diagonals
+static const float gSortDirections[TRS_SORT_DIRECTIONS][3] = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1},
+    {0.57735f, 0.57735f, 0.57735f}, {0.57735f, 0.57735f, -0.57735f}, {0.57735f, -0.57735f, 0.57735f}, {0.57735f, -0.57735f, -0.57735f},
+    {-0.57735f, 0.57735f, 0.57735f}, {-0.57735f, 0.57735f, -0.57735f}, {-0.57735f, -0.57735f, 0.57735f}, {-0.57735f, -0.57735f, -0.57735f},
+};
+
 trs_Hitbox trs_CalcHitbox(trs_Model model);
+int comp(const void *val1, const void *val2);
+static void trs_Batch2DQuad(SDL_Texture *texture, float u1, float v1, float u2, float v2, float x, float y, float w, float h, SDL_Color color);
+static void trs_RasterizerDestroy(trs_Rasterizer *raster);
+static void trs_BuildSortOrders(trs_Model model);
+static void trs_RasterizerResize(trs_Rasterizer *raster, int width, int height);
 
 //----------------- UTILITY METHODS -----------------//
 void _trs_CheckReturn(trs_ReturnType type, int line) {
@@ -140,9 +435,297 @@ uint8_t *trs_LoadFile(const char *filename, int *size) {
 	return buffer;
 }
 
+// Builds a path to file that is relative to the directory of another file
+static void trs_RelativePath(char *out, int size, const char *relativeTo, const char *file) {
+    const char *slash = strrchr(relativeTo, '/');
+    const int dirLength = slash == NULL ? 0 : (int)(slash - relativeTo) + 1;
+    snprintf(out, size, "%.*s%s", dirLength, relativeTo, file);
+}
+
 static void trs_GetTinyOBJFileData(void* ctx, const char* filename, const int is_mtl, const char* obj_filename, char** data, size_t* len) {
-    *data = gTinyOBJBuffer;
-    *len = gTinyOBJSize;
+    if (is_mtl) {
+        // Material libraries are optional, a missing one is an empty one
+        static char empty[] = "\n";
+        char path[1024];
+        trs_RelativePath(path, 1024, obj_filename, filename);
+        FILE *file = fopen(path, "rb");
+        if (file != NULL) {
+            fclose(file);
+            gTinyMTLBuffer = trs_LoadFile(path, &gTinyMTLSize);
+            *data = gTinyMTLBuffer;
+            *len = gTinyMTLSize;
+        } else {
+            *data = empty;
+            *len = 1;
+        }
+    } else {
+        *data = gTinyOBJBuffer;
+        *len = gTinyOBJSize;
+    }
+}
+
+//----------------- Arena -----------------//
+// Linear allocator for memory that's all freed at the same time. Anything that doesn't fit goes in its own
+// heap block until the next reset, which then grows the arena to the high-water mark so it fits next time.
+
+trs_Arena trs_CreateArena(size_t size) {
+    trs_Arena arena = trs_CheckMem(calloc(1, sizeof(struct trs_Arena_t)));
+    arena->size = size;
+    arena->memory = size > 0 ? trs_CheckMem(malloc(size)) : NULL;
+    return arena;
+}
+
+void *trs_ArenaAlloc(trs_Arena arena, size_t size) {
+    size = (size + TRS_ARENA_ALIGN - 1) & ~((size_t)TRS_ARENA_ALIGN - 1);
+    void *out;
+    if (arena->used + size <= arena->size) {
+        out = arena->memory + arena->used;
+        arena->used += size;
+    } else {
+        const size_t header = (sizeof(struct trs_ArenaBlock_t) + TRS_ARENA_ALIGN - 1) & ~((size_t)TRS_ARENA_ALIGN - 1);
+        trs_ArenaBlock *block = trs_CheckMem(malloc(header + size));
+        block->next = arena->overflow;
+        arena->overflow = block;
+        arena->overflowUsed += size;
+        arena->overflowCount++;
+        out = (uint8_t*)block + header;
+    }
+    if (arena->used + arena->overflowUsed > arena->highWater)
+        arena->highWater = arena->used + arena->overflowUsed;
+    return out;
+}
+
+void trs_ArenaReset(trs_Arena arena) {
+    if (arena->overflow != NULL) {
+        while (arena->overflow != NULL) {
+            trs_ArenaBlock *next = arena->overflow->next;
+            free(arena->overflow);
+            arena->overflow = next;
+        }
+        free(arena->memory);
+        arena->size = arena->highWater;
+        arena->memory = trs_CheckMem(malloc(arena->size));
+    }
+    arena->used = 0;
+    arena->overflowUsed = 0;
+}
+
+size_t trs_ArenaHighWater(trs_Arena arena) {
+    return arena->highWater;
+}
+
+void trs_FreeArena(trs_Arena arena) {
+    if (arena != NULL) {
+        while (arena->overflow != NULL) {
+            trs_ArenaBlock *next = arena->overflow->next;
+            free(arena->overflow);
+            arena->overflow = next;
+        }
+        free(arena->memory);
+        free(arena);
+    }
+}
+
+void *trs_FrameAlloc(size_t size) {
+    return trs_ArenaAlloc(gGameState->frameArena, size);
+}
+
+//----------------- Image/Atlas Methods -----------------//
+
+// Creates a texture from RGBA pixels, a copy of the pixels is kept for the software rasterizer
+static SDL_Texture *trs_CreateTextureRGBA(uint32_t *pixels, int w, int h) {
+    SDL_Texture *out = SDL_CreateTexture(gGameState->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, w, h);
+    trs_CheckSDL(out);
+    SDL_UpdateTexture(out, NULL, pixels, w * 4);
+    SDL_SetTextureBlendMode(out, SDL_BLENDMODE_BLEND);
+
+    gGameState->texturePixels = trs_CheckMem(realloc(gGameState->texturePixels, sizeof(struct trs_TexturePixels_t) * (gGameState->texturePixelCount + 1)));
+    trs_TexturePixels *copy = &gGameState->texturePixels[gGameState->texturePixelCount++];
+    copy->texture = out;
+    copy->w = w;
+    copy->h = h;
+    copy->pixels = trs_CheckMem(malloc(sizeof(uint32_t) * w * h));
+    memcpy(copy->pixels, pixels, sizeof(uint32_t) * w * h);
+    return out;
+}
+
+// Destroys a texture made by trs_CreateTextureRGBA
+static void trs_DestroyTextureRGBA(SDL_Texture *texture) {
+    for (int i = 0; i < gGameState->texturePixelCount; i++) {
+        if (gGameState->texturePixels[i].texture == texture) {
+            free(gGameState->texturePixels[i].pixels);
+            gGameState->texturePixels[i] = gGameState->texturePixels[--gGameState->texturePixelCount];
+            break;
+        }
+    }
+    SDL_DestroyTexture(texture);
+}
+
+// Returns the CPU copy of a texture, or NULL if it doesn't have one
+static const trs_TexturePixels *trs_GetTexturePixels(SDL_Texture *texture) {
+    for (int i = 0; i < gGameState->texturePixelCount; i++)
+        if (gGameState->texturePixels[i].texture == texture)
+            return &gGameState->texturePixels[i];
+    return NULL;
+}
+
+// Points an image at a rectangle of a texture and recalculates its uv mapping
+static void trs_ImageSetLocation(trs_Image image, SDL_Texture *texture, int x, int y, int textureWidth, int textureHeight) {
+    image->texture = texture;
+    image->rect.x = x;
+    image->rect.y = y;
+    image->textureWidth = textureWidth;
+    image->textureHeight = textureHeight;
+    image->uvOffset[0] = (float)x / textureWidth;
+    image->uvOffset[1] = (float)y / textureHeight;
+    image->uvScale[0] = (float)image->rect.w / textureWidth;
+    image->uvScale[1] = (float)image->rect.h / textureHeight;
+}
+
+// Takes ownership of the pixels, the image gets its own texture until it is packed into an atlas
+static trs_Image trs_CreateImage(uint32_t *pixels, int w, int h) {
+    trs_Image image = trs_CheckMem(calloc(1, sizeof(struct trs_Image_t)));
+    image->pixels = pixels;
+    image->rect.w = w;
+    image->rect.h = h;
+    image->ownsTexture = true;
+    trs_ImageSetLocation(image, trs_CreateTextureRGBA(pixels, w, h), 0, 0, w, h);
+
+    // Track it for the atlas
+    if (gGameState->imageCount == gGameState->imageSize) {
+        gGameState->imageSize = gGameState->imageSize == 0 ? 16 : gGameState->imageSize * 2;
+        gGameState->images = trs_CheckMem(realloc(gGameState->images, sizeof(trs_Image) * gGameState->imageSize));
+    }
+    gGameState->images[gGameState->imageCount++] = image;
+
+    return image;
+}
+
+trs_Image trs_LoadImage(const char *filename) {
+    int imageW, imageH, comp;
+    void *pixels = stbi_load(filename, &imageW, &imageH, &comp, 4);
+    trs_Assert(pixels != NULL);
+    return trs_CreateImage(pixels, imageW, imageH);
+}
+
+void trs_FreeImage(trs_Image image) {
+    if (image != NULL) {
+        for (int i = 0; i < gGameState->imageCount; i++) {
+            if (gGameState->images[i] == image) {
+                gGameState->images[i] = gGameState->images[--gGameState->imageCount];
+                break;
+            }
+        }
+        if (image->ownsTexture)
+            trs_DestroyTextureRGBA(image->texture);
+        stbi_image_free(image->pixels);
+        free(image);
+    }
+}
+
+// Tallest images first packs the skyline the tightest
+static int trs_AtlasComp(const void *val1, const void *val2) {
+    const trs_Image image1 = *(const trs_Image*)val1;
+    const trs_Image image2 = *(const trs_Image*)val2;
+    if (image1->rect.h != image2->rect.h)
+        return image1->rect.h > image2->rect.h ? -1 : 1;
+    return image1->rect.w > image2->rect.w ? -1 : 1;
+}
+
+// Finds the lowest spot on the skyline a w*h rectangle fits, returns false if it doesn't fit anywhere
+static bool trs_SkylineFind(int *skyline, int w, int h, int *outX, int *outY) {
+    int bestX = -1;
+    int bestY = TRS_ATLAS_PAGE_SIZE;
+    for (int x = 0; x + w <= TRS_ATLAS_PAGE_SIZE; x++) {
+        int y = 0;
+        for (int i = x; i < x + w && y < bestY; i++)
+            if (skyline[i] > y)
+                y = skyline[i];
+        if (y + h <= TRS_ATLAS_PAGE_SIZE && y < bestY) {
+            bestX = x;
+            bestY = y;
+        }
+    }
+    *outX = bestX;
+    *outY = bestY;
+    return bestX != -1;
+}
+
+// Copies an image into a page and extrudes its edges into the padding
+static void trs_AtlasBlit(uint32_t *page, trs_Image image, int x, int y) {
+    const uint32_t *pixels = image->pixels;
+    for (int py = -TRS_ATLAS_PADDING; py < image->rect.h + TRS_ATLAS_PADDING; py++) {
+        const int srcY = clamp(py, 0, image->rect.h - 1);
+        for (int px = -TRS_ATLAS_PADDING; px < image->rect.w + TRS_ATLAS_PADDING; px++) {
+            const int srcX = clamp(px, 0, image->rect.w - 1);
+            page[((y + py) * TRS_ATLAS_PAGE_SIZE) + x + px] = pixels[(srcY * image->rect.w) + srcX];
+        }
+    }
+}
+
+void trs_BuildAtlas() {
+    trs_InvalidateFrame(); // uvs move into the atlas
+    // Gather every image that isn't in an atlas yet and is small enough to be
+    const int pad = TRS_ATLAS_PADDING * 2;
+    trs_Image *pending = trs_CheckMem(malloc(sizeof(trs_Image) * (gGameState->imageCount + 1)));
+    int pendingCount = 0;
+    for (int i = 0; i < gGameState->imageCount; i++) {
+        trs_Image image = gGameState->images[i];
+        if (image->pixels != NULL && image->rect.w + pad <= TRS_ATLAS_PAGE_SIZE && image->rect.h + pad <= TRS_ATLAS_PAGE_SIZE)
+            pending[pendingCount++] = image;
+    }
+    qsort(pending, pendingCount, sizeof(trs_Image), trs_AtlasComp);
+
+    // Fill pages until everything is packed
+    uint32_t *page = trs_CheckMem(malloc(sizeof(uint32_t) * TRS_ATLAS_PAGE_SIZE * TRS_ATLAS_PAGE_SIZE));
+    int *skyline = trs_CheckMem(malloc(sizeof(int) * TRS_ATLAS_PAGE_SIZE));
+    int *placed = trs_CheckMem(malloc(sizeof(int) * 2 * (pendingCount + 1)));
+    while (pendingCount > 0) {
+        memset(page, 0, sizeof(uint32_t) * TRS_ATLAS_PAGE_SIZE * TRS_ATLAS_PAGE_SIZE);
+        memset(skyline, 0, sizeof(int) * TRS_ATLAS_PAGE_SIZE);
+
+        // Place what fits on this page, anything that doesn't is left for the next one
+        int placedCount = 0;
+        for (int i = 0; i < pendingCount; i++) {
+            trs_Image image = pending[i];
+            int x, y;
+            if (trs_SkylineFind(skyline, image->rect.w + pad, image->rect.h + pad, &x, &y)) {
+                for (int j = x; j < x + image->rect.w + pad; j++)
+                    skyline[j] = y + image->rect.h + pad;
+                trs_AtlasBlit(page, image, x + TRS_ATLAS_PADDING, y + TRS_ATLAS_PADDING);
+                placed[(placedCount * 2) + 0] = x + TRS_ATLAS_PADDING;
+                placed[(placedCount * 2) + 1] = y + TRS_ATLAS_PADDING;
+                pending[placedCount++] = image; // never overtakes i, so this is safe
+            }
+        }
+
+        // Move the images over to the new page
+        SDL_Texture *texture = trs_CreateTextureRGBA(page, TRS_ATLAS_PAGE_SIZE, TRS_ATLAS_PAGE_SIZE);
+        gGameState->atlasPages = trs_CheckMem(realloc(gGameState->atlasPages, sizeof(SDL_Texture*) * (gGameState->atlasPageCount + 1)));
+        gGameState->atlasPages[gGameState->atlasPageCount++] = texture;
+        for (int i = 0; i < placedCount; i++) {
+            trs_Image image = pending[i];
+            trs_DestroyTextureRGBA(image->texture);
+            stbi_image_free(image->pixels);
+            image->pixels = NULL;
+            image->ownsTexture = false;
+            trs_ImageSetLocation(image, texture, placed[i * 2], placed[(i * 2) + 1], TRS_ATLAS_PAGE_SIZE, TRS_ATLAS_PAGE_SIZE);
+        }
+
+        // Whatever didn't fit goes around again
+        pendingCount = 0;
+        for (int i = 0; i < gGameState->imageCount; i++) {
+            trs_Image image = gGameState->images[i];
+            if (image->pixels != NULL && image->rect.w + pad <= TRS_ATLAS_PAGE_SIZE && image->rect.h + pad <= TRS_ATLAS_PAGE_SIZE)
+                pending[pendingCount++] = image;
+        }
+        qsort(pending, pendingCount, sizeof(trs_Image), trs_AtlasComp);
+    }
+
+    free(placed);
+    free(skyline);
+    free(page);
+    free(pending);
 }
 
 //----------------- TRIANGLE LIST METHODS -----------------//
@@ -151,34 +734,57 @@ void trs_TriangleListEmpty(trs_TriangleList *list) {
     list->size = 0;
     free(list->vertices);
     list->vertices = NULL;
-    free(list->verticesSDL);
-    list->verticesSDL = NULL;
+    free(list->info);
+    list->info = NULL;
 }
 
 void trs_TriangleListReset(trs_TriangleList *list) {
     list->count = 0;
 }
 
+// Returns false and counts the triangles as dropped if they would put the frame over its triangle budget
+static bool trs_FitsTriangleBudget(int triangles) {
+    const int budget = gGameState->config.maxTriangles;
+    if (budget <= 0 || (gGameState->triangleList.count / 3) + triangles <= budget)
+        return true;
+    gGameState->budgetStats.droppedTriangles += triangles;
+    return false;
+}
+
 // Guarantees the list has at least this much extra capacity size
 void trs_TriangleListGuaranteeAdditional(trs_TriangleList *list, int size) {
     trs_Assert(size % 3 == 0);
     if (list->size - list->count < size) {
-        list->vertices = realloc(list->vertices, sizeof(trs_Vertex) * (list->size + (size * 2)));
+        int newSize = list->size * 2;
+        if (newSize < list->count + size)
+            newSize = list->count + size;
+        list->vertices = realloc(list->vertices, sizeof(trs_Vertex) * newSize);
         trs_CheckMem(list->vertices);
-        list->verticesSDL = realloc(list->verticesSDL, sizeof(SDL_Vertex) * (list->size + (size * 2)));
-        trs_CheckMem(list->verticesSDL);
-        list->size += size * 2;
+        list->info = realloc(list->info, sizeof(struct trs_TriangleInfo_t) * (newSize / 3));
+        trs_CheckMem(list->info);
+        list->size = newSize;
     }
 }
 
 // Adds an object (a bunch of triangles) to a triangle list, multiplying each position by a model matrix
 void trs_TriangleListAddObject(trs_TriangleList *list, trs_Vertex *vertices, int count, mat4 model) {
+    if (list == &gGameState->triangleList && !trs_FitsTriangleBudget(count / 3))
+        return;
     trs_TriangleListGuaranteeAdditional(list, count);
+    trs_Image texture = gGameState->uvtexture;
     
-    // Copy new ones over while multiplying by model matrix
+    // Copy new ones over while multiplying by model matrix, these use the global texture
     for (int i = 0; i < count; i++) {
         list->vertices[list->count + i] = vertices[i];
         glm_mat4_mulv(model, list->vertices[list->count + i].position, list->vertices[list->count + i].position);
+        list->vertices[list->count + i].uv[0] = texture->uvOffset[0] + (vertices[i].uv[0] * texture->uvScale[0]);
+        list->vertices[list->count + i].uv[1] = texture->uvOffset[1] + (vertices[i].uv[1] * texture->uvScale[1]);
+    }
+    for (int i = 0; i < count / 3; i++) {
+        list->info[(list->count / 3) + i].texture = texture->texture;
+        list->info[(list->count / 3) + i].cullMode = TRS_CULL_NONE;
+        list->info[(list->count / 3) + i].id = gGameState->triangleIdCount++;
+        list->info[(list->count / 3) + i].stream = TRS_STREAM_SORTED;
     }
 
     list->count += count;
@@ -186,58 +792,165 @@ void trs_TriangleListAddObject(trs_TriangleList *list, trs_Vertex *vertices, int
 
 //----------------- Model Methods -----------------//
 
+// Orders edges by their endpoints so shared edges end up next to each other
+static int trs_EdgeComp(const void *val1, const void *val2) {
+    const float *edge1 = val1;
+    const float *edge2 = val2;
+    for (int i = 0; i < 6; i++)
+        if (edge1[i] != edge2[i])
+            return edge1[i] < edge2[i] ? -1 : 1;
+    return 0;
+}
+
+// Returns true if position 1 sorts before position 2
+static bool trs_PositionLess(const float *pos1, const float *pos2) {
+    for (int i = 0; i < 3; i++)
+        if (pos1[i] != pos2[i])
+            return pos1[i] < pos2[i];
+    return false;
+}
+
+// Closed meshes (every edge shared by exactly two triangles) can't show their inside, so they cull
+// whichever side faces inward according to the sign of their volume, anything else is double-sided
+static trs_CullMode trs_DetectCullMode(trs_Model model) {
+    if (model->count < 3)
+        return TRS_CULL_NONE;
+
+    // Every edge as two positions, smallest first
+    float *edges = trs_CheckMem(malloc(sizeof(float) * 6 * model->count));
+    float volume = 0;
+    for (int tri = 0; tri < model->count / 3; tri++) {
+        float *v[3];
+        for (int i = 0; i < 3; i++)
+            v[i] = model->vertices[(tri * 3) + i].position;
+        for (int i = 0; i < 3; i++) {
+            const float *pos1 = v[i];
+            const float *pos2 = v[(i + 1) % 3];
+            if (trs_PositionLess(pos2, pos1)) {
+                const float *temp = pos1;
+                pos1 = pos2;
+                pos2 = temp;
+            }
+            memcpy(&edges[((tri * 3) + i) * 6], pos1, sizeof(float) * 3);
+            memcpy(&edges[(((tri * 3) + i) * 6) + 3], pos2, sizeof(float) * 3);
+        }
+
+        // Signed volume of the tetrahedron to the origin
+        vec3 cross;
+        glm_vec3_cross(v[1], v[2], cross);
+        volume += glm_vec3_dot(v[0], cross);
+    }
+    qsort(edges, model->count, sizeof(float) * 6, trs_EdgeComp);
+
+    bool closed = true;
+    int run = 1;
+    for (int i = 1; i <= model->count && closed; i++) {
+        if (i < model->count && trs_EdgeComp(&edges[(i - 1) * 6], &edges[i * 6]) == 0) {
+            run++;
+        } else {
+            closed = run == 2;
+            run = 1;
+        }
+    }
+    free(edges);
+
+    if (!closed || volume == 0)
+        return TRS_CULL_NONE;
+    return volume > 0 ? TRS_CULL_BACK : TRS_CULL_FRONT;
+}
+
+// Returns the image for a material texture, textures shared between models are only loaded once
+static trs_Image trs_LoadMaterialTexture(const char *filename) {
+    for (int i = 0; i < gGameState->materialTextureCount; i++)
+        if (strcmp(gGameState->materialTextures[i].filename, filename) == 0)
+            return gGameState->materialTextures[i].image;
+    gGameState->materialTextures = trs_CheckMem(realloc(gGameState->materialTextures, sizeof(struct trs_MaterialTexture_t) * (gGameState->materialTextureCount + 1)));
+    trs_MaterialTexture *texture = &gGameState->materialTextures[gGameState->materialTextureCount++];
+    texture->filename = trs_CheckMem(malloc(strlen(filename) + 1));
+    strcpy(texture->filename, filename);
+    texture->image = trs_LoadImage(filename);
+    return texture->image;
+}
+
 trs_Model trs_LoadModel(const char *filename) {
     // Load obj - from tinyobj viewer example
     gTinyOBJBuffer = trs_LoadFile(filename, &gTinyOBJSize);
+    gTinyMTLBuffer = NULL;
     tinyobj_attrib_t attrib;
     tinyobj_shape_t* shapes = NULL;
     size_t num_shapes;
     tinyobj_material_t* materials = NULL;
     size_t num_materials;
     unsigned int flags = TINYOBJ_FLAG_TRIANGULATE;
-    int ret = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials, &num_materials, "asd", trs_GetTinyOBJFileData, NULL, flags);
+    int ret = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials, &num_materials, filename, trs_GetTinyOBJFileData, NULL, flags);
     trs_Assert(ret == TINYOBJ_SUCCESS);
 
     // Allocate
-    trs_Vertex *newVertices = trs_CheckMem(calloc(attrib.num_faces * 3, sizeof(trs_Vertex)));
-    trs_Model model = trs_CheckMem(malloc(sizeof(struct trs_Model_t)));
-    model->count = attrib.num_faces * 3;
+    trs_Vertex *newVertices = trs_CheckMem(calloc(attrib.num_faces, sizeof(trs_Vertex)));
+    trs_Model model = trs_CheckMem(calloc(1, sizeof(struct trs_Model_t)));
+    model->count = attrib.num_faces;
     model->vertices = newVertices;
     int currentVertex = 0;
 
-    // Parse vertices
-    for (int faceIndex = 0; faceIndex < attrib.num_faces; faceIndex++) {
-        trs_Vertex vertex = {0};
-        const int vertexIndex = attrib.faces[faceIndex].v_idx;
-		const int textureIndex = attrib.faces[faceIndex].vt_idx;
-
-        // account for the renderer coordinate system being wack
-        vec3 pos = {attrib.vertices[(vertexIndex * 3) + 0], attrib.vertices[(vertexIndex * 3) + 1], attrib.vertices[(vertexIndex * 3) + 2]};
-        glm_vec3_rotate(pos, GLM_PI / 2, (vec3){1, 0, 0});
+    // Faces are grouped by material, -1 being the faces without one
+    for (int material = -1; material < (int)num_materials; material++) {
+        const int first = currentVertex;
+
+        // Parse vertices
+        for (unsigned int faceIndex = 0; faceIndex < attrib.num_faces; faceIndex++) {
+            const int materialID = attrib.material_ids[faceIndex / 3];
+            if (materialID != material && !(material == -1 && (materialID < 0 || materialID >= (int)num_materials)))
+                continue;
+            trs_Vertex vertex = {0};
+            const int vertexIndex = attrib.faces[faceIndex].v_idx;
+            const int textureIndex = attrib.faces[faceIndex].vt_idx;
+
+            // account for the renderer coordinate system being wack
+            vec3 pos = {attrib.vertices[(vertexIndex * 3) + 0], attrib.vertices[(vertexIndex * 3) + 1], attrib.vertices[(vertexIndex * 3) + 2]};
+            glm_vec3_rotate(pos, GLM_PI / 2, (vec3){1, 0, 0});
+
+            // Copy vertex
+            vertex.position[0] = pos[0];
+            vertex.position[1] = pos[1];
+            vertex.position[2] = pos[2];
+            vertex.position[3] = 1;
+            vertex.uv[0] = attrib.texcoords[(textureIndex * 2) + 0];
+            vertex.uv[1] = 1 - attrib.texcoords[(textureIndex * 2) + 1];
+            newVertices[currentVertex++] = vertex;
+        }
 
-        // Copy vertex
-        vertex.position[0] = pos[0];
-        vertex.position[1] = pos[1];
-        vertex.position[2] = pos[2];
-        vertex.position[3] = 1;
-        vertex.uv[0] = attrib.texcoords[(textureIndex * 2) + 0];
-        vertex.uv[1] = 1 - attrib.texcoords[(textureIndex * 2) + 1];
-        newVertices[currentVertex++] = vertex;
+        // Make a group for the material if it has any faces
+        if (currentVertex > first) {
+            model->groups = trs_CheckMem(realloc(model->groups, sizeof(struct trs_ModelGroup_t) * (model->groupCount + 1)));
+            trs_ModelGroup *group = &model->groups[model->groupCount++];
+            group->first = first;
+            group->count = currentVertex - first;
+            group->texture = NULL;
+            if (material != -1 && materials[material].diffuse_texname != NULL && materials[material].diffuse_texname[0] != 0) {
+                char path[1024];
+                trs_RelativePath(path, 1024, filename, materials[material].diffuse_texname);
+                group->texture = trs_LoadMaterialTexture(path);
+            }
+        }
     }
 
     // Free tinyobj
     tinyobj_attrib_free(&attrib);
     tinyobj_shapes_free(shapes, num_shapes);
     tinyobj_materials_free(materials, num_materials);
+    free(gTinyOBJBuffer);
+    free(gTinyMTLBuffer);
 
     model->hitbox = trs_CalcHitbox(model);
+    model->cullMode = trs_DetectCullMode(model);
+    trs_BuildSortOrders(model);
 
     return model;
 }
 
 trs_Model trs_CreateModel(trs_Vertex *vertices, int count) {
     trs_Vertex *newVertices = trs_CheckMem(malloc(sizeof(trs_Vertex) * count));
-    trs_Model model = trs_CheckMem(malloc(sizeof(struct trs_Model_t)));
+    trs_Model model = trs_CheckMem(calloc(1, sizeof(struct trs_Model_t)));
     model->count = count;
     model->vertices = newVertices;
 
@@ -246,21 +959,162 @@ trs_Model trs_CreateModel(trs_Vertex *vertices, int count) {
         newVertices[i] = vertices[i];
     }
 
+    // Everything uses the global texture to start with
+    model->groups = trs_CheckMem(malloc(sizeof(struct trs_ModelGroup_t)));
+    model->groupCount = 1;
+    model->groups[0].first = 0;
+    model->groups[0].count = count;
+    model->groups[0].texture = NULL;
+
     model->hitbox = trs_CalcHitbox(model);
+    model->cullMode = trs_DetectCullMode(model);
+    trs_BuildSortOrders(model);
 
     return model;
 }
 
-void trs_DrawModel(trs_Model model, mat4 modelMatrix) {
+void trs_SetModelTexture(trs_Model model, trs_Image texture) {
+    trs_InvalidateFrame();
+    for (int i = 0; i < model->groupCount; i++)
+        model->groups[i].texture = texture;
+}
+
+void trs_SetModelGroupTexture(trs_Model model, int group, trs_Image texture) {
+    trs_Assert(group >= 0 && group < model->groupCount);
+    model->groups[group].texture = texture;
+    trs_InvalidateFrame();
+}
+
+// Copies one of a model's triangles to the end of the triangle list in world space
+static void trs_ExpandTriangle(trs_Model model, trs_ModelGroup *group, int tri, mat4 modelMatrix, trs_CullMode cullMode, int id, int stream) {
+    trs_TriangleList *list = &gGameState->triangleList;
+    trs_Image texture = group->texture != NULL ? group->texture : gGameState->uvtexture;
+
+    // Multiply by model matrix and move uvs to wherever the texture lives
+    for (int i = 0; i < 3; i++) {
+        trs_Vertex *vertex = &list->vertices[list->count + i];
+        *vertex = model->vertices[(tri * 3) + i];
+        glm_mat4_mulv(modelMatrix, vertex->position, vertex->position);
+        vertex->uv[0] = texture->uvOffset[0] + (vertex->uv[0] * texture->uvScale[0]);
+        vertex->uv[1] = texture->uvOffset[1] + (vertex->uv[1] * texture->uvScale[1]);
+    }
+    trs_TriangleInfo *info = &list->info[list->count / 3];
+    info->texture = texture->texture;
+    info->cullMode = cullMode;
+    info->id = id;
+    info->stream = stream;
+    list->count += 3;
+}
+
+// Copies a model's triangles to the triangle list in world space, in group order or the given triangle
+// order, triangle ids are firstId + the triangle's index in the model
+static void trs_ExpandModel(trs_Model model, mat4 modelMatrix, int firstId, const int *order, int stream) {
+    if (!trs_FitsTriangleBudget(model->count / 3))
+        return;
     trs_TriangleListGuaranteeAdditional(&gGameState->triangleList, model->count);
-    
-    // Copy new ones over while multiplying by model matrix
-    for (int i = 0; i < model->count; i++) {
-        gGameState->triangleList.vertices[gGameState->triangleList.count + i] = model->vertices[i];
-        glm_mat4_mulv(modelMatrix, gGameState->triangleList.vertices[gGameState->triangleList.count + i].position, gGameState->triangleList.vertices[gGameState->triangleList.count + i].position);
+
+    // Mirroring matrices flip the winding of every triangle
+    trs_CullMode cullMode = model->cullMode;
+    vec3 cross;
+    glm_vec3_cross(modelMatrix[1], modelMatrix[2], cross);
+    if (glm_vec3_dot(modelMatrix[0], cross) < 0 && cullMode != TRS_CULL_NONE)
+        cullMode = cullMode == TRS_CULL_BACK ? TRS_CULL_FRONT : TRS_CULL_BACK;
+
+    if (order == NULL) {
+        for (int group = 0; group < model->groupCount; group++) {
+            const int first = model->groups[group].first / 3;
+            for (int tri = first; tri < first + (model->groups[group].count / 3); tri++)
+                trs_ExpandTriangle(model, &model->groups[group], tri, modelMatrix, cullMode, firstId + tri, stream);
+        }
+    } else {
+        for (int i = 0; i < model->count / 3; i++) {
+            const int tri = order[i];
+            int group = 0;
+            while (group < model->groupCount - 1 && tri >= (model->groups[group].first + model->groups[group].count) / 3)
+                group++;
+            trs_ExpandTriangle(model, &model->groups[group], tri, modelMatrix, cullMode, firstId + tri, stream);
+        }
+    }
+}
+
+// Builds the model's back to front triangle order for each of the sort directions
+static void trs_BuildSortOrders(trs_Model model) {
+    const int triangles = model->count / 3;
+    free(model->sortOrders);
+    model->sortOrders = NULL;
+    if (triangles == 0)
+        return;
+    model->sortOrders = trs_CheckMem(malloc(sizeof(int) * triangles * TRS_SORT_DIRECTIONS));
+    trs_TriangleDepth *keys = trs_CheckMem(malloc(sizeof(struct trs_TriangleDepth_t) * triangles));
+
+    // Triangles further along the view direction are further from the eye
+    for (int direction = 0; direction < TRS_SORT_DIRECTIONS; direction++) {
+        for (int tri = 0; tri < triangles; tri++) {
+            vec3 centre = {0};
+            for (int i = 0; i < 3; i++)
+                glm_vec3_add(centre, model->vertices[(tri * 3) + i].position, centre);
+            keys[tri].averageDepth = glm_vec3_dot(centre, (float*)gSortDirections[direction]);
+            keys[tri].lowestDepth = keys[tri].averageDepth;
+            keys[tri].index = tri;
+        }
+        qsort(keys, triangles, sizeof(struct trs_TriangleDepth_t), comp);
+        for (int tri = 0; tri < triangles; tri++)
+            model->sortOrders[(direction * triangles) + tri] = keys[tri].index;
     }
+    free(keys);
+}
+
+// Returns the model's precomputed triangle order closest to looking at the instance from the eye
+static const int *trs_InstanceSortOrder(trs_Instance *instance, vec3 centre) {
+    if (instance->model->sortOrders == NULL)
+        return NULL;
+
+    // View direction in model space
+    mat4 inverse;
+    vec3 view, direction;
+    glm_vec3_sub(centre, gGameState->camera.eyes, view);
+    glm_mat4_inv(instance->matrix, inverse);
+    glm_mat4_mulv3(inverse, view, 0, direction);
+
+    int best = 0;
+    float bestDot = -FLT_MAX;
+    for (int i = 0; i < TRS_SORT_DIRECTIONS; i++) {
+        const float dot = glm_vec3_dot(direction, (float*)gSortDirections[i]);
+        if (dot > bestDot) {
+            bestDot = dot;
+            best = i;
+        }
+    }
+    return &instance->model->sortOrders[best * (instance->model->count / 3)];
+}
+
+void trs_SetModelLOD(trs_Model model, trs_Model lod, float distance) {
+    model->lod = lod;
+    model->lodDistance = distance;
+    trs_InvalidateFrame();
+}
+
+// Returns the model an instance should be drawn with for its distance from the camera
+static trs_Model trs_InstanceLOD(trs_Instance *instance) {
+    trs_Model model = instance->model;
+    const float distance = glm_vec3_distance(instance->matrix[3], gGameState->camera.eyes) * gGameState->lodBias;
+    while (model->lod != NULL && distance > model->lodDistance)
+        model = model->lod;
+    return model;
+}
 
-    gGameState->triangleList.count += model->count;
+void trs_DrawModel(trs_Model model, mat4 modelMatrix) {
+    if (gGameState->config.maxInstances > 0 && gGameState->instanceCount == gGameState->config.maxInstances) {
+        gGameState->budgetStats.droppedInstances++;
+        return;
+    }
+    if (gGameState->instanceCount == gGameState->instanceSize) {
+        gGameState->instanceSize = gGameState->instanceSize == 0 ? 64 : gGameState->instanceSize * 2;
+        gGameState->instances = trs_CheckMem(realloc(gGameState->instances, sizeof(struct trs_Instance_t) * gGameState->instanceSize));
+    }
+    trs_Instance *instance = &gGameState->instances[gGameState->instanceCount++];
+    instance->model = model;
+    glm_mat4_copy(modelMatrix, instance->matrix);
 }
 
 void trs_DrawModelExt(trs_Model model, float x, float y, float z, float scaleX, float scaleY, float scaleZ, float rotationX, float rotationY, float rotationZ) {
@@ -279,9 +1133,21 @@ void trs_DrawModelExt(trs_Model model, float x, float y, float z, float scaleX,
     trs_DrawModel(model, modelMatrix);
 }
 
+void trs_SetModelCullMode(trs_Model model, trs_CullMode cullMode) {
+    model->cullMode = cullMode;
+    trs_InvalidateFrame();
+}
+
+void trs_SetModelOccluder(trs_Model model, bool occluder) {
+    model->occluder = occluder;
+    trs_InvalidateFrame();
+}
+
 void trs_FreeModel(trs_Model model) {
     if (model != NULL) {
         free(model->vertices);
+        free(model->groups);
+        free(model->sortOrders);
         trs_FreeHitbox(model->hitbox);
         free(model);
     }
@@ -293,13 +1159,14 @@ trs_Font trs_LoadFont(const char *filename, int w, int h) {
     trs_Font font = trs_CheckMem(malloc(sizeof(struct trs_Font_t)));
     font->w = w;
     font->h = h;
-    font->bitmap = trs_LoadPNG(filename);
+    font->bitmap = trs_LoadImage(filename);
     return font;
 }
 
 void trs_DrawFont(trs_Font font, float x, float y, const char *fmt, ...) {
     float horizontal = x;
-    int width, height;
+    trs_Image bitmap = font->bitmap;
+    const int width = bitmap->rect.w;
     
     // Deal with varargs
     char buffer[1024];
@@ -309,7 +1176,6 @@ void trs_DrawFont(trs_Font font, float x, float y, const char *fmt, ...) {
     va_end(list);
     char *string = buffer;
 
-    SDL_QueryTexture(font->bitmap, NULL, NULL, &width, &height);
     while (*string != 0) {
         if (*string == 32) { // space
             horizontal += font->w;
@@ -317,19 +1183,14 @@ void trs_DrawFont(trs_Font font, float x, float y, const char *fmt, ...) {
             horizontal = x;
             y += font->h;
         } else if (*string > 32 && *string < 128) { // normal character
-            SDL_Rect src = {
-                .x = ((*string - 32) * font->w) % width,
-                .y = ((int)((*string - 32) * font->w) / width) * font->h,
-                .w = font->w,
-                .h = font->h
-            };
-            SDL_Rect dst = {
-                .x = horizontal,
-                .y = y,
-                .w = font->w,
-                .h = font->h
-            };
-            SDL_RenderCopy(gGameState->renderer, font->bitmap, &src, &dst);
+            // Glyph location in the bitmap's texture, which may be an atlas page
+            const float srcX = bitmap->rect.x + (((*string - 32) * font->w) % width);
+            const float srcY = bitmap->rect.y + (((int)((*string - 32) * font->w) / width) * font->h);
+            trs_Batch2DQuad(
+                    bitmap->texture,
+                    srcX / bitmap->textureWidth, srcY / bitmap->textureHeight, (srcX + font->w) / bitmap->textureWidth, (srcY + font->h) / bitmap->textureHeight,
+                    (int)horizontal, (int)y, font->w, font->h,
+                    (SDL_Color){255, 255, 255, 255});
             horizontal += font->w;
         }
         string++;
@@ -338,11 +1199,165 @@ void trs_DrawFont(trs_Font font, float x, float y, const char *fmt, ...) {
 
 void trs_FreeFont(trs_Font font) {
     if (font != NULL) {
-        SDL_DestroyTexture(font->bitmap);
+        trs_FreeImage(font->bitmap);
         free(font);
     }
 }
 
+//----------------- 2D Batch Methods -----------------//
+
+// Makes room for one more item in the batch
+static trs_Batch2DItem *trs_Batch2DAddItem(SDL_Texture *texture) {
+    trs_Batch2D *batch = &gGameState->batch;
+    if (gGameState->config.maxUIQuads > 0 && batch->count >= gGameState->config.maxUIQuads) {
+        // Over budget, the item is filled in and thrown away
+        static trs_Batch2DItem dropped;
+        gGameState->budgetStats.droppedQuads++;
+        return &dropped;
+    }
+    if (batch->count == batch->size) {
+        batch->size = batch->size == 0 ? 64 : batch->size * 2;
+        trs_Batch2DItem *items = trs_FrameAlloc(sizeof(struct trs_Batch2DItem_t) * batch->size);
+        if (batch->count > 0)
+            memcpy(items, batch->items, sizeof(struct trs_Batch2DItem_t) * batch->count);
+        batch->items = items;
+    }
+    trs_Batch2DItem *item = &batch->items[batch->count];
+    item->texture = texture;
+    item->layer = batch->layer;
+    item->order = batch->count++;
+    return item;
+}
+
+// Queues a quad with the given uv rectangle and colour
+static void trs_Batch2DQuad(SDL_Texture *texture, float u1, float v1, float u2, float v2, float x, float y, float w, float h, SDL_Color color) {
+    trs_Batch2DItem *item = trs_Batch2DAddItem(texture);
+    item->vertices[0] = (SDL_Vertex){.position = {x, y}, .color = color, .tex_coord = {u1, v1}};
+    item->vertices[1] = (SDL_Vertex){.position = {x + w, y}, .color = color, .tex_coord = {u2, v1}};
+    item->vertices[2] = (SDL_Vertex){.position = {x + w, y + h}, .color = color, .tex_coord = {u2, v2}};
+    item->vertices[3] = (SDL_Vertex){.position = {x, y + h}, .color = color, .tex_coord = {u1, v2}};
+}
+
+void trs_Batch2DSetLayer(int layer) {
+    gGameState->batch.layer = layer;
+}
+
+void trs_Batch2DTexture(SDL_Texture *texture, SDL_Rect *src, float x, float y, float w, float h) {
+    int width, height;
+    SDL_QueryTexture(texture, NULL, NULL, &width, &height);
+    if (src == NULL) {
+        trs_Batch2DQuad(texture, 0, 0, 1, 1, x, y, w, h, (SDL_Color){255, 255, 255, 255});
+    } else {
+        trs_Batch2DQuad(
+                texture,
+                (float)src->x / width, (float)src->y / height, (float)(src->x + src->w) / width, (float)(src->y + src->h) / height,
+                x, y, w, h,
+                (SDL_Color){255, 255, 255, 255});
+    }
+}
+
+void trs_Batch2DImage(trs_Image image, SDL_Rect *src, float x, float y, float w, float h) {
+    SDL_Rect rect = src == NULL ? (SDL_Rect){0, 0, image->rect.w, image->rect.h} : *src;
+    rect.x += image->rect.x;
+    rect.y += image->rect.y;
+    trs_Batch2DQuad(
+            image->texture,
+            (float)rect.x / image->textureWidth, (float)rect.y / image->textureHeight, (float)(rect.x + rect.w) / image->textureWidth, (float)(rect.y + rect.h) / image->textureHeight,
+            x, y, w, h,
+            (SDL_Color){255, 255, 255, 255});
+}
+
+void trs_Batch2DLine(float x1, float y1, float x2, float y2, SDL_Color color) {
+    // Lines are drawn as a one pixel wide quad around the line
+    float dx = x2 - x1;
+    float dy = y2 - y1;
+    const float length = sqrtf((dx * dx) + (dy * dy));
+    if (length == 0) {
+        trs_Batch2DPoint(x1, y1, color);
+        return;
+    }
+    const float nx = (-dy / length) * 0.5f;
+    const float ny = (dx / length) * 0.5f;
+
+    // Extend the ends by half a pixel so the endpoints are covered like SDL_RenderDrawLine
+    dx = (dx / length) * 0.5f;
+    dy = (dy / length) * 0.5f;
+    x1 += 0.5f - dx;
+    y1 += 0.5f - dy;
+    x2 += 0.5f + dx;
+    y2 += 0.5f + dy;
+
+    // Sample the middle of the white pixel
+    trs_Image white = gGameState->whiteImage;
+    const float u = white->uvOffset[0] + (white->uvScale[0] * 0.5f);
+    const float v = white->uvOffset[1] + (white->uvScale[1] * 0.5f);
+    trs_Batch2DItem *item = trs_Batch2DAddItem(white->texture);
+    item->vertices[0] = (SDL_Vertex){.position = {x1 + nx, y1 + ny}, .color = color, .tex_coord = {u, v}};
+    item->vertices[1] = (SDL_Vertex){.position = {x2 + nx, y2 + ny}, .color = color, .tex_coord = {u, v}};
+    item->vertices[2] = (SDL_Vertex){.position = {x2 - nx, y2 - ny}, .color = color, .tex_coord = {u, v}};
+    item->vertices[3] = (SDL_Vertex){.position = {x1 - nx, y1 - ny}, .color = color, .tex_coord = {u, v}};
+}
+
+void trs_Batch2DPoint(float x, float y, SDL_Color color) {
+    trs_Image white = gGameState->whiteImage;
+    const float u = white->uvOffset[0] + (white->uvScale[0] * 0.5f);
+    const float v = white->uvOffset[1] + (white->uvScale[1] * 0.5f);
+    trs_Batch2DQuad(white->texture, u, v, u, v, (int)x, (int)y, 1, 1, color);
+}
+
+// Orders items by layer, then texture, then submission order
+static int trs_Batch2DComp(const void *val1, const void *val2) {
+    const trs_Batch2DItem *item1 = val1;
+    const trs_Batch2DItem *item2 = val2;
+    if (item1->layer != item2->layer)
+        return item1->layer < item2->layer ? -1 : 1;
+    if (item1->texture != item2->texture)
+        return (uintptr_t)item1->texture < (uintptr_t)item2->texture ? -1 : 1;
+    return item1->order < item2->order ? -1 : 1;
+}
+
+void trs_Batch2DFlush() {
+    trs_Batch2D *batch = &gGameState->batch;
+    if (batch->count == 0) {
+        batch->layer = 0;
+        return;
+    }
+
+    // Make sure the index buffer can hold every quad, it's the same for every flush so it's kept
+    batch->vertices = trs_FrameAlloc(sizeof(SDL_Vertex) * 4 * batch->count);
+    if (batch->vertexSize < batch->count) {
+        const int oldSize = batch->vertexSize;
+        batch->vertexSize = batch->size;
+        batch->indices = trs_CheckMem(realloc(batch->indices, sizeof(int) * 6 * batch->vertexSize));
+        for (int i = oldSize; i < batch->vertexSize; i++) {
+            batch->indices[(i * 6) + 0] = (i * 4) + 0;
+            batch->indices[(i * 6) + 1] = (i * 4) + 1;
+            batch->indices[(i * 6) + 2] = (i * 4) + 2;
+            batch->indices[(i * 6) + 3] = (i * 4) + 2;
+            batch->indices[(i * 6) + 4] = (i * 4) + 3;
+            batch->indices[(i * 6) + 5] = (i * 4) + 0;
+        }
+    }
+
+    // Group everything by texture while keeping layers in order
+    qsort(batch->items, batch->count, sizeof(struct trs_Batch2DItem_t), trs_Batch2DComp);
+    for (int i = 0; i < batch->count; i++)
+        memcpy(&batch->vertices[i * 4], batch->items[i].vertices, sizeof(SDL_Vertex) * 4);
+
+    // Draw each run of the same texture in one call
+    int runStart = 0;
+    for (int i = 1; i <= batch->count; i++) {
+        if (i == batch->count || batch->items[i].texture != batch->items[runStart].texture) {
+            const int quads = i - runStart;
+            SDL_RenderGeometry(gGameState->renderer, batch->items[runStart].texture, &batch->vertices[runStart * 4], quads * 4, batch->indices, quads * 6);
+            runStart = i;
+        }
+    }
+
+    batch->count = 0;
+    batch->layer = 0;
+}
+
 //----------------- Hitbox -----------------//
 
 trs_Hitbox trs_CreateHitbox(float x1, float y1, float z1, float x2, float y2, float z2) {
@@ -416,83 +1431,976 @@ void trs_FreeHitbox(trs_Hitbox hb) {
 
 //----------------- Sound Methods -----------------//
 
+// Converts a loaded source to the mixing rate so the mixer never has to pitch shift it
+static void trs_CookSource(cs_audio_source_t *source) {
+    if (source->sample_rate == s_ctx->Hz || source->sample_count == 0)
+        return;
+    const double step = (double)source->sample_rate / s_ctx->Hz;
+    const int count = (int)(((int64_t)source->sample_count * s_ctx->Hz) / source->sample_rate);
+    const int wide = (count + 3) / 4;
+    float *cooked = trs_CheckMem(cs_malloc16(sizeof(float) * 4 * wide * source->channel_count));
+    for (int c = 0; c < source->channel_count; c++) {
+        const float *in = source->channels[c];
+        float *out = cooked + (c * 4 * wide);
+        for (int i = 0; i < count; i++) {
+            const double position = i * step;
+            const int first = (int)position;
+            const int second = first + 1 < source->sample_count ? first + 1 : first;
+            const float t = position - first;
+            out[i] = in[first] + ((in[second] - in[first]) * t);
+        }
+        for (int i = count; i < wide * 4; i++)
+            out[i] = 0;
+    }
+    cs_free16(source->channels[0]);
+    source->channels[0] = cooked;
+    source->channels[1] = source->channel_count == 2 ? cooked + (4 * wide) : NULL;
+    source->sample_count = count;
+    source->sample_rate = s_ctx->Hz;
+}
+
 trs_Sound trs_LoadSound(const char *filename) {
     cs_error_t err;
-    void *out = cs_load_wav(filename, &err);
-    trs_Assert(out != NULL);
+    trs_Sound sound = trs_CheckMem(calloc(1, sizeof(struct trs_Sound_t)));
+    sound->source = cs_load_wav(filename, &err);
+    trs_Assert(sound->source != NULL);
+    trs_CookSource(sound->source);
+    return sound;
+}
+
+void trs_SaveSound(trs_Sound sound, const char *filename) {
+    cs_audio_source_t *source = sound->source;
+    SDL_RWops *file = SDL_RWFromFile(filename, "wb");
+    trs_CheckSDL(file);
+    const Uint32 dataSize = source->sample_count * source->channel_count * sizeof(int16_t);
+    SDL_RWwrite(file, "RIFF", 1, 4);
+    SDL_WriteLE32(file, 36 + dataSize);
+    SDL_RWwrite(file, "WAVEfmt ", 1, 8);
+    SDL_WriteLE32(file, 16);
+    SDL_WriteLE16(file, 1); // pcm
+    SDL_WriteLE16(file, source->channel_count);
+    SDL_WriteLE32(file, source->sample_rate);
+    SDL_WriteLE32(file, source->sample_rate * source->channel_count * sizeof(int16_t));
+    SDL_WriteLE16(file, source->channel_count * sizeof(int16_t));
+    SDL_WriteLE16(file, 16);
+    SDL_RWwrite(file, "data", 1, 4);
+    SDL_WriteLE32(file, dataSize);
+    for (int i = 0; i < source->sample_count; i++) {
+        for (int c = 0; c < source->channel_count; c++) {
+            const float sample = ((float*)source->channels[c])[i];
+            SDL_WriteLE16(file, (Sint16)(sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample));
+        }
+    }
+    SDL_RWclose(file);
+}
+
+void trs_SetSoundPriority(trs_Sound sound, int priority) {
+    sound->priority = priority;
+}
+
+void trs_SetSoundMaxInstances(trs_Sound sound, int maxInstances) {
+    sound->maxInstances = maxInstances;
+}
+
+// Forgets voices the mixer has finished with
+static void trs_ReapVoices() {
+    cs_lock();
+    for (int i = 0; i < gGameState->voiceCount;) {
+        if (!cs_sound_is_active(gGameState->voices[i].playing))
+            gGameState->voices[i] = gGameState->voices[--gGameState->voiceCount];
+        else
+            i++;
+    }
+    cs_unlock();
+}
+
+// True if voice 1 should be stolen before voice 2, least important then quietest then oldest
+static bool trs_VoiceLess(trs_Voice *voice1, trs_Voice *voice2) {
+    if (voice1->sound->priority != voice2->sound->priority)
+        return voice1->sound->priority < voice2->sound->priority;
+    if (voice1->volume != voice2->volume)
+        return voice1->volume < voice2->volume;
+    return voice1->order < voice2->order;
+}
+
+// Returns the audible voice to steal for a sound, -1 if there's a free one and -2 if it shouldn't be mixed
+static int trs_ChooseVictim(trs_Sound sound) {
+    int audible = 0;
+    int victim = -1;
+    for (int i = 0; i < gGameState->voiceCount; i++) {
+        if (!gGameState->voices[i].virtual) {
+            audible++;
+            if (victim == -1 || trs_VoiceLess(&gGameState->voices[i], &gGameState->voices[victim]))
+                victim = i;
+        }
+    }
+
+    // Out of voices, only steal from sounds that aren't more important
+    if (gGameState->config.maxVoices <= 0 || audible < gGameState->config.maxVoices)
+        return -1;
+    return gGameState->voices[victim].sound->priority <= sound->priority ? victim : -2;
+}
+
+// Returns the least important virtual voice, -1 if there are none, and how many there are
+static int trs_LeastVirtualVoice(int *count) {
+    int victim = -1;
+    *count = 0;
+    for (int i = 0; i < gGameState->voiceCount; i++) {
+        if (gGameState->voices[i].virtual) {
+            (*count)++;
+            if (victim == -1 || trs_VoiceLess(&gGameState->voices[i], &gGameState->voices[victim]))
+                victim = i;
+        }
+    }
+    return victim;
+}
+
+// Returns the virtual voice to stop for a sound starting out of earshot, -1 if there's room for it and -2
+// if every virtual voice is more important
+static int trs_ChooseVirtualVictim(trs_Sound sound) {
+    int count;
+    const int victim = trs_LeastVirtualVoice(&count);
+    if (gGameState->config.maxVirtualVoices <= 0 || count < gGameState->config.maxVirtualVoices)
+        return -1;
+    return gGameState->voices[victim].sound->priority <= sound->priority ? victim : -2;
+}
+
+// Returns the voice a new sound should take, voiceCount for a free one or -1 if it shouldn't play,
+// virtual voices aren't mixed so they have their own budget
+static int trs_ChooseVoice(trs_Sound sound, bool virtual) {
+    // A sound at its instance limit restarts its oldest instance
+    if (sound->maxInstances > 0) {
+        int instances = 0;
+        int oldest = -1;
+        for (int i = 0; i < gGameState->voiceCount; i++) {
+            if (gGameState->voices[i].sound == sound) {
+                instances++;
+                if (oldest == -1 || gGameState->voices[i].order < gGameState->voices[oldest].order)
+                    oldest = i;
+            }
+        }
+        if (instances >= sound->maxInstances) {
+            if (virtual || !gGameState->voices[oldest].virtual)
+                return oldest;
+            return trs_ChooseVictim(sound) == -1 ? oldest : -1; // it has to become audible
+        }
+    }
+    const int victim = virtual ? trs_ChooseVirtualVictim(sound) : trs_ChooseVictim(sound);
+    return victim == -1 ? gGameState->voiceCount : victim == -2 ? -1 : victim;
+}
+
+// Starts a sound on a voice picked by trs_ChooseVoice, virtual voices start paused
+static trs_Voice *trs_StartVoice(trs_Sound sound, float volume, float pan, bool looping, bool virtual) {
+    trs_ReapVoices();
+    const int voice = trs_ChooseVoice(sound, virtual);
+    if (voice == -1) {
+        gGameState->audioStats.rejectedVoices++;
+        return NULL;
+    }
+    if (voice == gGameState->voiceCount && gGameState->voiceCount == gGameState->voiceSize) {
+        gGameState->voiceSize = gGameState->voiceSize == 0 ? 16 : gGameState->voiceSize * 2;
+        gGameState->voices = trs_CheckMem(realloc(gGameState->voices, sizeof(struct trs_Voice_t) * gGameState->voiceSize));
+    }
+
+    cs_sound_params_t p = cs_sound_params_default();
+    p.looped = looping;
+    p.volume = volume;
+    p.pan = pan;
+    p.paused = virtual;
+    cs_lock();
+    if (voice < gGameState->voiceCount) {
+        cs_sound_stop(gGameState->voices[voice].playing);
+        gGameState->audioStats.stolenVoices++;
+    } else {
+        gGameState->voiceCount++;
+    }
+    trs_Voice *out = &gGameState->voices[voice];
+    memset(out, 0, sizeof(struct trs_Voice_t));
+    out->sound = sound;
+    out->playing = cs_play_sound(sound->source, p);
+    out->volume = virtual ? 0 : volume;
+    out->baseVolume = volume;
+    out->looping = looping;
+    out->order = ++gGameState->voiceOrder;
+    out->virtual = virtual;
+    out->virtualSince = SDL_GetPerformanceCounter();
+    cs_unlock();
     return out;
 }
 
-void trs_PlaySound(trs_Sound sound, float volume, bool looping) {
-    cs_sound_params_t p = {
-        .looped = looping,
-        .paused = false,
-        .volume = volume
-    };
-    cs_play_sound(sound, p);
+trs_VoiceID trs_PlaySound(trs_Sound sound, float volume, bool looping) {
+    trs_Voice *voice = trs_StartVoice(sound, volume, 0.5f, looping, false);
+    return voice != NULL ? voice->order : 0;
 }
 
-void trs_StopAllSound() {
-    cs_stop_all_playing_sounds();
+// Volume and pan of a sound at a position for the camera, volume is 0 past the radius
+static void trs_Spatialize(vec3 position, float volume, float radius, float *outVolume, float *outPan) {
+    trs_Camera *camera = &gGameState->camera;
+    vec3 offset;
+    glm_vec3_sub(position, camera->eyes, offset);
+    const float distance = glm_vec3_norm(offset);
+    if (distance >= radius) {
+        *outVolume = 0;
+        *outPan = 0.5f;
+        return;
+    }
+    const float falloff = 1 - (distance / radius);
+    *outVolume = volume * falloff * falloff;
+
+    // Same right vector as the view matrix, flat so looking up and down doesn't swing the pan
+    vec3 forward = {cos(camera->rotation), sin(camera->rotation), 0};
+    vec3 up = {0, 0, -1};
+    vec3 right;
+    glm_vec3_cross(forward, up, right);
+    offset[2] = 0;
+    const float flatDistance = glm_vec3_norm(offset);
+    *outPan = flatDistance > 0 ? 0.5f + (0.5f * glm_vec3_dot(offset, right) / flatDistance) : 0.5f;
 }
 
-void trs_FreeSound(trs_Sound sound) {
-    cs_free_audio_source(sound);
+trs_VoiceID trs_PlaySound3D(trs_Sound sound, vec3 position, float volume, float radius, bool looping) {
+    float level, pan;
+    trs_Spatialize(position, volume, radius, &level, &pan);
+    trs_Voice *voice = trs_StartVoice(sound, level, pan, looping, level <= 0);
+    if (voice == NULL)
+        return 0;
+    voice->positional = true;
+    voice->baseVolume = volume;
+    voice->radius = radius;
+    glm_vec3_copy(position, voice->position);
+    return voice->order;
 }
 
-//----------------- Main Methods -----------------//
+// Index of a voice that's still playing, -1 if it's done
+static int trs_FindVoice(trs_VoiceID id) {
+    for (int i = 0; i < gGameState->voiceCount; i++)
+        if (gGameState->voices[i].order == id)
+            return i;
+    return -1;
+}
 
-trs_Camera *trs_GetCamera() {
-    return &gGameState->camera;
+// Stops a voice and gives its slot to the last one, call with cute_sound locked
+static void trs_RemoveVoice(int voice) {
+    cs_sound_stop(gGameState->voices[voice].playing);
+    gGameState->voices[voice] = gGameState->voices[--gGameState->voiceCount];
 }
 
-void trs_Init(SDL_Renderer *renderer, SDL_Window *window, float logicalWidth, float logicalHeight) {
-    // Create the game state and target texture
-    gGameState = trs_CheckMem(calloc(1, sizeof(struct trs_GameState_t)));
-    gGameState->renderer = renderer;
-    gGameState->window = window;
-    gGameState->logicalWidth = logicalWidth;
-    gGameState->logicalHeight = logicalHeight;
-    gGameState->target = SDL_CreateTexture(renderer, SDL_GetWindowPixelFormat(window), SDL_TEXTUREACCESS_TARGET, logicalWidth, logicalHeight);
-    trs_CheckSDL(gGameState->target);
+void trs_SetVoicePosition(trs_VoiceID id, vec3 position) {
+    const int voice = trs_FindVoice(id);
+    if (voice != -1 && gGameState->voices[voice].positional)
+        glm_vec3_copy(position, gGameState->voices[voice].position);
+}
 
-    // Cute sound
-    cs_init(NULL, 44100, 1024 * 1024, &gCuteSound);
-    cs_spawn_mix_thread();
+void trs_StopVoice(trs_VoiceID id) {
+    cs_lock();
+    const int voice = trs_FindVoice(id);
+    if (voice != -1)
+        trs_RemoveVoice(voice);
+    cs_unlock();
+}
 
-    // Perspective matrix
-    glm_mat4_identity(gGameState->perspective);
-    glm_perspective(glm_rad(45.0f), logicalWidth / logicalHeight, 0.1, 100, gGameState->perspective);
+// Sample index a virtual voice would be at if it had kept playing, -1 if it would have finished
+static int trs_VirtualIndex(trs_Voice *voice) {
+    const double seconds = (double)(SDL_GetPerformanceCounter() - voice->virtualSince) / (double)SDL_GetPerformanceFrequency();
+    const int64_t index = voice->virtualIndex + (int64_t)(seconds * s_ctx->Hz);
+    const int count = voice->sound->source->sample_count;
+    if (index < count)
+        return index;
+    return voice->looping ? index % count : -1;
+}
 
-    // Load uv texture
-    gGameState->uvtexture = trs_LoadPNG("res/textures.png");
+// Moves positional voices' volume and pan with the camera, taking ones out of earshot off the mixer
+static void trs_UpdateVoices() {
+    trs_ReapVoices();
+    cs_lock();
+    for (int i = 0; i < gGameState->voiceCount;) {
+        trs_Voice *voice = &gGameState->voices[i];
+        if (!voice->positional) {
+            i++;
+            continue;
+        }
+        float level, pan;
+        trs_Spatialize(voice->position, voice->baseVolume, voice->radius, &level, &pan);
+
+        if (voice->virtual) {
+            // Done playing while nobody could hear it
+            const int index = trs_VirtualIndex(voice);
+            if (index == -1) {
+                trs_RemoveVoice(i);
+                continue;
+            }
+
+            // Back in earshot picks up where it would be, if there's a voice for it
+            if (level > 0 && trs_ChooseVictim(voice->sound) == -1) {
+                cs_sound_set_sample_index(voice->playing, index);
+                cs_sound_set_volume(voice->playing, level);
+                cs_sound_set_pan(voice->playing, pan);
+                cs_sound_set_is_paused(voice->playing, false);
+                voice->virtual = false;
+                voice->volume = level;
+            }
+        } else if (level <= 0) {
+            voice->virtual = true;
+            voice->virtualIndex = cs_sound_get_sample_index(voice->playing);
+            voice->virtualSince = SDL_GetPerformanceCounter();
+            voice->volume = 0;
+            cs_sound_set_is_paused(voice->playing, true);
+        } else {
+            voice->volume = level;
+            cs_sound_set_volume(voice->playing, level);
+            cs_sound_set_pan(voice->playing, pan);
+        }
+        i++;
+    }
+
+    // Voices that just went out of earshot can put the virtual ones over budget
+    int count;
+    int victim = trs_LeastVirtualVoice(&count);
+    while (gGameState->config.maxVirtualVoices > 0 && count > gGameState->config.maxVirtualVoices) {
+        trs_RemoveVoice(victim);
+        gGameState->audioStats.stolenVoices++;
+        victim = trs_LeastVirtualVoice(&count);
+    }
+    cs_unlock();
 }
 
-void trs_End() {
+void trs_StopAllSound() {
     cs_stop_all_playing_sounds();
-    SDL_DestroyTexture(gGameState->uvtexture);
-    SDL_DestroyTexture(gGameState->target);
-    trs_TriangleListEmpty(&gGameState->triangleList);
+    gGameState->voiceCount = 0;
 }
 
-void trs_BeginFrame() {
-    trs_TriangleListReset(&gGameState->triangleList);
+// Feeds the device from cute_sound's queue like its own callback does, but counts underruns
+static void trs_AudioCallback(void *data, Uint8 *stream, int length) {
+    SDL_atomic_t *underruns = data;
+    const int zeros = cs_pull_bytes(stream, length);
+    memset(stream + (length - zeros), 0, zeros);
+    if (zeros > 0)
+        SDL_AtomicAdd(underruns, 1);
 }
 
-bool trs_InFrustrum(vec4 *frustum, vec4 point) {
-    for (int i = 0; i < 6; i++) {
-        if (glm_vec4_dot(frustum[i], point) < 0) {
+// Starts cute_sound with the mixer's buffers sized for the biggest queue and reopens the device with a short period,
+// returns false if no device could be opened, in which case nothing is ever mixed
+static bool trs_InitAudio(trs_Config *config) {
+    const int frequency = config->audioFrequency > 0 ? config->audioFrequency : TRS_AUDIO_FREQUENCY;
+    gGameState->audioAutoLatency = config->audioLatency <= 0;
+    gGameState->audioLatency = gGameState->audioAutoLatency ? TRS_AUDIO_MIN_LATENCY : config->audioLatency;
+    gGameState->audioMaxLatency = gGameState->audioLatency > TRS_AUDIO_MAX_LATENCY ? gGameState->audioLatency : TRS_AUDIO_MAX_LATENCY;
+    cs_init(NULL, frequency, gGameState->audioMaxLatency, &gCuteSound);
+
+    // cute_sound asks for a device buffer as big as its queue, which is most of the latency
+    SDL_CloseAudioDevice(s_ctx->dev);
+    SDL_AudioSpec wanted = {0};
+    SDL_AudioSpec have;
+    wanted.freq = frequency;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 2;
+    wanted.samples = TRS_AUDIO_DEVICE_FRAMES;
+    wanted.callback = trs_AudioCallback;
+    wanted.userdata = &gGameState->audioUnderruns;
+    s_ctx->dev = SDL_OpenAudioDevice(NULL, 0, &wanted, &have, 0);
+
+    // Some drivers won't take a period that short, so fall back to the buffer cute_sound asked for and a fixed full queue
+    if (s_ctx->dev == 0) {
+        fprintf(stderr, "Failed to open a low latency audio device, SDL error \"%s\".\n", SDL_GetError());
+        gGameState->audioAutoLatency = false;
+        gGameState->audioLatency = gGameState->audioMaxLatency;
+        wanted.samples = gGameState->audioMaxLatency;
+        s_ctx->dev = SDL_OpenAudioDevice(NULL, 0, &wanted, &have, 0);
+        if (s_ctx->dev == 0) {
+            fprintf(stderr, "Failed to open an audio device, SDL error \"%s\".\n", SDL_GetError());
             return false;
         }
     }
+    s_ctx->latency_samples = gGameState->audioLatency;
+
+    // Mix a full queue before the device starts pulling from it
+    cs_mix();
+    if (config->audioMixDelay > 0)
+        cs_mix_thread_sleep_delay(config->audioMixDelay);
+    cs_spawn_mix_thread();
+    SDL_PauseAudioDevice(s_ctx->dev, 0);
     return true;
 }
 
-// Goes through the triangle list and builds the backbuffer with all the triangles within the camera frustrum
-void trs_FrustumCull(mat4 viewproj) {
-    // Make sure the backbuffer can handle the potential new triangles
-    trs_TriangleListGuaranteeAdditional(&gGameState->backbuffer, gGameState->triangleList.count);
+// Doubles the automatic queue after an underrun, so it settles on the smallest that keeps up on this machine
+static void trs_UpdateAudio() {
+    const int underruns = SDL_AtomicGet(&gGameState->audioUnderruns);
+    if (underruns == gGameState->audioUnderrunsSeen)
+        return;
+    gGameState->audioUnderrunsSeen = underruns;
+    if (gGameState->audioAutoLatency && gGameState->audioLatency < gGameState->audioMaxLatency) {
+        gGameState->audioLatency *= 2;
+        if (gGameState->audioLatency > gGameState->audioMaxLatency)
+            gGameState->audioLatency = gGameState->audioMaxLatency;
+        cs_lock();
+        s_ctx->latency_samples = gGameState->audioLatency;
+        cs_unlock();
+    }
+}
+
+trs_AudioStats trs_GetAudioStats() {
+    trs_ReapVoices();
+    trs_AudioStats stats = gGameState->audioStats;
+    stats.activeVoices = gGameState->voiceCount;
+    stats.virtualVoices = 0;
+    for (int i = 0; i < gGameState->voiceCount; i++)
+        stats.virtualVoices += gGameState->voices[i].virtual;
+    cs_lock();
+    stats.queuedFrames = s_ctx->samples_in_circular_buffer;
+    cs_unlock();
+    stats.latencyFrames = gGameState->audioLatency;
+    stats.underruns = SDL_AtomicGet(&gGameState->audioUnderruns);
+    return stats;
+}
+
+void trs_FreeSound(trs_Sound sound) {
+    if (sound != NULL) {
+        cs_lock();
+        for (int i = 0; i < gGameState->voiceCount;) {
+            if (gGameState->voices[i].sound == sound) {
+                cs_sound_stop(gGameState->voices[i].playing);
+                gGameState->voices[i] = gGameState->voices[--gGameState->voiceCount];
+            } else {
+                i++;
+            }
+        }
+        cs_unlock();
+        cs_free_audio_source(sound->source);
+        free(sound);
+    }
+}
+
+// Finds the format and sample data of a wav, the same ones cute_sound can load
+static bool trs_StreamReadHeader(trs_Stream stream) {
+    char id[4];
+    bool format = false;
+    if (SDL_RWread(stream->file, id, 1, 4) != 4 || memcmp(id, "RIFF", 4) != 0)
+        return false;
+    SDL_ReadLE32(stream->file);
+    if (SDL_RWread(stream->file, id, 1, 4) != 4 || memcmp(id, "WAVE", 4) != 0)
+        return false;
+    while (SDL_RWread(stream->file, id, 1, 4) == 4) {
+        const Uint32 size = SDL_ReadLE32(stream->file);
+        const Sint64 next = SDL_RWtell(stream->file) + size + (size & 1);
+        if (memcmp(id, "fmt ", 4) == 0) {
+            const Uint16 tag = SDL_ReadLE16(stream->file);
+            stream->channels = SDL_ReadLE16(stream->file);
+            stream->sampleRate = SDL_ReadLE32(stream->file);
+            SDL_ReadLE32(stream->file); // bytes per second
+            SDL_ReadLE16(stream->file); // block align
+            const Uint16 bits = SDL_ReadLE16(stream->file);
+            if (tag != 1 || bits != 16 || (stream->channels != 1 && stream->channels != 2))
+                return false;
+            format = true;
+        } else if (memcmp(id, "data", 4) == 0 && format) {
+            stream->dataStart = SDL_RWtell(stream->file);
+            stream->frames = size / (stream->channels * sizeof(int16_t));
+            return stream->frames > 0;
+        }
+        SDL_RWseek(stream->file, next, RW_SEEK_SET);
+    }
+    return false;
+}
+
+// Writes count frames to the ring after what's already written, silence once a stream that doesn't loop runs out
+static void trs_StreamFill(trs_Stream stream, int count) {
+    float *left = stream->ring->channels[0];
+    float *right = stream->ring->channels[1];
+    while (count > 0) {
+        if (stream->fileFrame == stream->frames && stream->looping) {
+            stream->fileFrame = 0;
+            SDL_RWseek(stream->file, stream->dataStart, RW_SEEK_SET);
+        }
+
+        // Silence after the end
+        if (stream->fileFrame == stream->frames) {
+            if (stream->end < 0)
+                stream->end = stream->written;
+            for (int i = 0; i < count; i++) {
+                const int frame = (stream->written + i) % TRS_AUDIO_RING_FRAMES;
+                left[frame] = 0;
+                if (right != NULL)
+                    right[frame] = 0;
+            }
+            stream->written += count;
+            return;
+        }
+
+        // Next chunk from the file
+        int frames = count < TRS_AUDIO_CHUNK_FRAMES ? count : TRS_AUDIO_CHUNK_FRAMES;
+        if (frames > stream->frames - stream->fileFrame)
+            frames = stream->frames - stream->fileFrame;
+        const int read = SDL_RWread(stream->file, stream->chunk, sizeof(int16_t) * stream->channels, frames);
+        if (read <= 0) { // truncated file, end it where the data stops
+            stream->frames = stream->fileFrame;
+            if (stream->frames == 0)
+                stream->looping = false;
+            continue;
+        }
+        for (int i = 0; i < read; i++) {
+            const int frame = (stream->written + i) % TRS_AUDIO_RING_FRAMES;
+            left[frame] = stream->chunk[i * stream->channels];
+            if (right != NULL)
+                right[frame] = stream->chunk[(i * 2) + 1];
+        }
+        stream->written += read;
+        stream->fileFrame += read;
+        count -= read;
+    }
+}
+
+// Keeps the ring filled ahead of the mixer until the stream is stopped or plays out
+static int trs_StreamThread(void *data) {
+    trs_Stream stream = data;
+    while (SDL_AtomicGet(&stream->running)) {
+        cs_lock();
+        const bool active = cs_sound_is_active(stream->playing);
+        const int index = cs_sound_get_sample_index(stream->playing);
+        cs_unlock();
+        if (!active)
+            break;
+        stream->played += index >= stream->lastIndex ? index - stream->lastIndex : (TRS_AUDIO_RING_FRAMES - stream->lastIndex) + index;
+        stream->lastIndex = index;
+
+        // Played everything in the file
+        if (stream->end >= 0 && stream->played >= stream->end) {
+            cs_lock();
+            cs_sound_stop(stream->playing);
+            cs_unlock();
+            break;
+        }
+
+        const int space = TRS_AUDIO_RING_FRAMES - TRS_AUDIO_GUARD_FRAMES - (int)(stream->written - stream->played);
+        if (space >= TRS_AUDIO_CHUNK_FRAMES)
+            trs_StreamFill(stream, space);
+        SDL_Delay(TRS_AUDIO_POLL_MS);
+    }
+    return 0;
+}
+
+trs_Stream trs_LoadStream(const char *filename) {
+    trs_Stream stream = trs_CheckMem(calloc(1, sizeof(struct trs_Stream_t)));
+    stream->file = SDL_RWFromFile(filename, "rb");
+    trs_CheckSDL(stream->file);
+    trs_Assert(trs_StreamReadHeader(stream));
+    stream->chunk = trs_CheckMem(malloc(sizeof(int16_t) * 2 * TRS_AUDIO_CHUNK_FRAMES));
+
+    // Ring buffer laid out like cute_sound's own sources so the mixer can play it
+    stream->ring = trs_CheckMem(CUTE_SOUND_ALLOC(sizeof(cs_audio_source_t), s_mem_ctx));
+    memset(stream->ring, 0, sizeof(cs_audio_source_t));
+    stream->ring->sample_rate = stream->sampleRate;
+    stream->ring->sample_count = TRS_AUDIO_RING_FRAMES;
+    stream->ring->channel_count = stream->channels;
+    stream->ring->channels[0] = trs_CheckMem(cs_malloc16(sizeof(float) * TRS_AUDIO_RING_FRAMES * stream->channels));
+    if (stream->channels == 2)
+        stream->ring->channels[1] = (float*)stream->ring->channels[0] + TRS_AUDIO_RING_FRAMES;
+    return stream;
+}
+
+void trs_PlayStream(trs_Stream stream, float volume, bool looping) {
+    trs_StopStream(stream);
+
+    // Fill the whole ring before the mixer starts on it
+    stream->looping = looping;
+    stream->fileFrame = 0;
+    stream->written = 0;
+    stream->played = 0;
+    stream->lastIndex = 0;
+    stream->end = -1;
+    SDL_RWseek(stream->file, stream->dataStart, RW_SEEK_SET);
+    trs_StreamFill(stream, TRS_AUDIO_RING_FRAMES - TRS_AUDIO_GUARD_FRAMES);
+
+    cs_sound_params_t p = cs_sound_params_default();
+    p.looped = true;
+    p.volume = volume;
+    cs_lock();
+    stream->playing = cs_play_sound(stream->ring, p);
+    cs_unlock();
+    SDL_AtomicSet(&stream->running, 1);
+    stream->thread = SDL_CreateThread(trs_StreamThread, "trs_Stream", stream);
+    trs_CheckSDL(stream->thread);
+}
+
+void trs_StopStream(trs_Stream stream) {
+    if (stream->thread != NULL) {
+        SDL_AtomicSet(&stream->running, 0);
+        SDL_WaitThread(stream->thread, NULL);
+        stream->thread = NULL;
+    }
+    cs_lock();
+    cs_sound_stop(stream->playing);
+    cs_unlock();
+    stream->playing = CUTE_PLAYING_SOUND_INVALID;
+}
+
+bool trs_StreamPlaying(trs_Stream stream) {
+    cs_lock();
+    const bool active = cs_sound_is_active(stream->playing);
+    cs_unlock();
+    return active;
+}
+
+void trs_FreeStream(trs_Stream stream) {
+    if (stream != NULL) {
+        trs_StopStream(stream);
+        cs_free_audio_source(stream->ring); // waits for the mixer to let go of it
+        SDL_RWclose(stream->file);
+        free(stream->chunk);
+        free(stream);
+    }
+}
+
+//----------------- Governor -----------------//
+// Watches frame times and trades draw distance and detail for speed when frames take longer than the
+// target. It only steps down after frames have been slow for a while and only steps back up after
+// they've been fast for much longer so it doesn't flip between levels, and fog hides the far plane moving.
+
+// Far plane scale and lod bias at each governor level
+static const float gGovernorFarScales[TRS_GOVERNOR_LEVELS] = {1, 0.8f, 0.65f, 0.5f, 0.4f};
+static const float gGovernorLODBiases[TRS_GOVERNOR_LEVELS] = {1, 1.5f, 2, 3, 4};
+static const float gGovernorResolutionScales[TRS_GOVERNOR_LEVELS] = {1, 1, 0.85f, 0.75f, 0.6f};
+
+// Records the time since last frame and moves between levels if needed
+static void trs_GovernorUpdate() {
+    trs_Governor *governor = &gGameState->governor;
+    const Uint64 now = SDL_GetPerformanceCounter();
+    const double frameTime = governor->lastFrame == 0 ? 0 : (double)(now - governor->lastFrame) / SDL_GetPerformanceFrequency();
+    governor->lastFrame = now;
+    if (governor->targetFrameTime <= 0 || frameTime == 0)
+        return;
+    governor->averageFrameTime = governor->averageFrameTime == 0 ? frameTime : (governor->averageFrameTime * 0.9) + (frameTime * 0.1);
+
+    // Count how long the average has been on either side of the target
+    if (governor->averageFrameTime > governor->targetFrameTime * TRS_GOVERNOR_SLOW) {
+        governor->framesSlow++;
+        governor->framesFast = 0;
+    } else if (governor->averageFrameTime < governor->targetFrameTime * TRS_GOVERNOR_FAST) {
+        governor->framesFast++;
+        governor->framesSlow = 0;
+    } else {
+        governor->framesSlow = 0;
+        governor->framesFast = 0;
+    }
+
+    if (governor->framesSlow >= TRS_GOVERNOR_DOWN_FRAMES && governor->level < TRS_GOVERNOR_LEVELS - 1) {
+        governor->level++;
+        governor->framesSlow = 0;
+    } else if (governor->framesFast >= TRS_GOVERNOR_UP_FRAMES && governor->level > 0) {
+        governor->level--;
+        governor->framesFast = 0;
+    }
+}
+
+// Sets the perspective matrix and fog distances for the base far plane and the governor's level
+static void trs_UpdatePerspective() {
+    const int level = gGameState->governor.targetFrameTime > 0 ? gGameState->governor.level : 0;
+    const float farPlane = gGameState->farPlane * gGovernorFarScales[level];
+    glm_perspective(glm_rad(45.0f), (float)gGameState->targetWidth / gGameState->targetHeight, TRS_NEAR_PLANE, farPlane, gGameState->perspective);
+    gGameState->lodBias = gGovernorLODBiases[level];
+    gGameState->fogStart = gGameState->fog ? farPlane * TRS_FOG_START : 0;
+    gGameState->fogEnd = gGameState->fog ? farPlane : 0;
+}
+
+// Returns how much fog there is at a view depth, 0 for none and 1 for completely fogged
+static inline float trs_FogAmount(float depth, float fogStart, float fogEnd) {
+    if (fogEnd <= fogStart || depth <= fogStart)
+        return 0;
+    return depth >= fogEnd ? 1 : (depth - fogStart) / (fogEnd - fogStart);
+}
+
+void trs_SetGovernor(double targetFrameTime) {
+    gGameState->governor.targetFrameTime = targetFrameTime;
+    gGameState->governor.averageFrameTime = 0;
+    gGameState->governor.framesSlow = 0;
+    gGameState->governor.framesFast = 0;
+    gGameState->governor.level = 0;
+}
+
+int trs_GetGovernorLevel() {
+    return gGameState->governor.level;
+}
+
+void trs_SetFarPlane(float farPlane) {
+    gGameState->farPlane = farPlane;
+    trs_InvalidateFrame();
+}
+
+void trs_SetFog(bool fog) {
+    gGameState->fog = fog;
+    trs_InvalidateFrame();
+}
+
+void trs_SetGovernorResolution(bool scaleResolution) {
+    gGameState->governorResolution = scaleResolution;
+}
+
+//----------------- Frame Reuse -----------------//
+
+static inline uint64_t trs_HashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * TRS_HASH_PRIME;
+    return hash;
+}
+
+// Hashes everything trs_EndFrame draws from, field by field so struct padding stays out of it
+static uint64_t trs_FrameHash() {
+    uint64_t hash = TRS_HASH_OFFSET;
+    trs_Camera *camera = &gGameState->camera;
+    hash = trs_HashBytes(hash, camera->eyes, sizeof(vec3));
+    hash = trs_HashBytes(hash, &camera->rotation, sizeof(float));
+    hash = trs_HashBytes(hash, &camera->rotationZ, sizeof(float));
+    const int generation = SDL_AtomicGet(&gGameState->frameGeneration);
+    hash = trs_HashBytes(hash, &generation, sizeof(int));
+    hash = trs_HashBytes(hash, &gGameState->governor.level, sizeof(int));
+    hash = trs_HashBytes(hash, &gGameState->targetWidth, sizeof(int));
+    hash = trs_HashBytes(hash, &gGameState->targetHeight, sizeof(int));
+    hash = trs_HashBytes(hash, &gGameState->bspCount, sizeof(int));
+    hash = trs_HashBytes(hash, gGameState->bsps, sizeof(trs_BSP) * gGameState->bspCount);
+
+    // Submitted models
+    hash = trs_HashBytes(hash, &gGameState->instanceCount, sizeof(int));
+    for (int i = 0; i < gGameState->instanceCount; i++) {
+        hash = trs_HashBytes(hash, &gGameState->instances[i].model, sizeof(trs_Model));
+        hash = trs_HashBytes(hash, gGameState->instances[i].matrix, sizeof(mat4));
+    }
+
+    // Triangles added to the list directly
+    hash = trs_HashBytes(hash, &gGameState->triangleList.count, sizeof(int));
+    for (int i = 0; i < gGameState->triangleList.count; i++) {
+        hash = trs_HashBytes(hash, gGameState->triangleList.vertices[i].position, sizeof(vec4));
+        hash = trs_HashBytes(hash, gGameState->triangleList.vertices[i].uv, sizeof(vec2));
+    }
+    return hash;
+}
+
+// Stretches a frame of 3D onto the logical size target so the ui can be drawn over it at full resolution
+static void trs_PresentFrame(SDL_Texture *frame) {
+    SDL_SetRenderTarget(gGameState->renderer, gGameState->target);
+    if (frame != gGameState->target)
+        SDL_RenderCopy(gGameState->renderer, frame, NULL, NULL);
+}
+
+// Puts the last frame's 3D back in the target, a separate render target still has it untouched
+static void trs_ReuseFrame() {
+    if (gGameState->backend == TRS_BACKEND_SOFTWARE)
+        trs_PresentFrame(gGameState->rasterizer.texture);
+    else if (gGameState->renderTarget == gGameState->target)
+        trs_PresentFrame(gGameState->frameCache);
+    else
+        trs_PresentFrame(gGameState->renderTarget);
+    gGameState->reusedFrames++;
+}
+
+// Keeps the sdl backend's frame around before the ui is drawn over it, only needed when the 3D is
+// rendered straight into the target
+static void trs_CacheFrame() {
+    if (gGameState->frameCache == NULL) {
+        gGameState->frameCache = SDL_CreateTexture(gGameState->renderer, SDL_GetWindowPixelFormat(gGameState->window), SDL_TEXTUREACCESS_TARGET, gGameState->targetWidth, gGameState->targetHeight);
+        trs_CheckSDL(gGameState->frameCache);
+        SDL_SetTextureBlendMode(gGameState->frameCache, SDL_BLENDMODE_NONE);
+    }
+    SDL_BlendMode blendMode;
+    SDL_GetTextureBlendMode(gGameState->target, &blendMode);
+    SDL_SetTextureBlendMode(gGameState->target, SDL_BLENDMODE_NONE);
+    SDL_SetRenderTarget(gGameState->renderer, gGameState->frameCache);
+    SDL_RenderCopy(gGameState->renderer, gGameState->target, NULL, NULL);
+    SDL_SetRenderTarget(gGameState->renderer, gGameState->target);
+    SDL_SetTextureBlendMode(gGameState->target, blendMode);
+}
+
+void trs_SetFrameReuse(bool frameReuse) {
+    gGameState->frameReuse = frameReuse;
+    gGameState->frameValid = false;
+}
+
+void trs_InvalidateFrame() {
+    SDL_AtomicAdd(&gGameState->frameGeneration, 1);
+}
+
+int trs_GetReusedFrameCount() {
+    return gGameState->reusedFrames;
+}
+
+//----------------- Main Methods -----------------//
+
+trs_Camera *trs_GetCamera() {
+    return &gGameState->camera;
+}
+
+// Recreates the render target and the rasterizer's buffers if the size changed, at the logical
+// resolution the 3D is rendered straight into the target
+static void trs_ResizeTarget(int width, int height) {
+    width = width < 1 ? 1 : width;
+    height = height < 1 ? 1 : height;
+    if (gGameState->renderTarget != NULL && width == gGameState->targetWidth && height == gGameState->targetHeight)
+        return;
+    if (gGameState->renderTarget != NULL && gGameState->renderTarget != gGameState->target)
+        SDL_DestroyTexture(gGameState->renderTarget);
+    if (gGameState->frameCache != NULL)
+        SDL_DestroyTexture(gGameState->frameCache);
+    gGameState->frameCache = NULL;
+    gGameState->frameValid = false;
+    if (width == (int)gGameState->logicalWidth && height == (int)gGameState->logicalHeight) {
+        gGameState->renderTarget = gGameState->target;
+    } else {
+        gGameState->renderTarget = SDL_CreateTexture(gGameState->renderer, SDL_GetWindowPixelFormat(gGameState->window), SDL_TEXTUREACCESS_TARGET, width, height);
+        trs_CheckSDL(gGameState->renderTarget);
+    }
+    gGameState->targetWidth = width;
+    gGameState->targetHeight = height;
+    if (gGameState->rasterizer.texture != NULL)
+        trs_RasterizerResize(&gGameState->rasterizer, width, height);
+}
+
+void trs_SetResolution(float width, float height) {
+    gGameState->renderWidth = width;
+    gGameState->renderHeight = height;
+}
+
+void trs_GetResolution(int *width, int *height) {
+    if (width != NULL)
+        *width = gGameState->targetWidth;
+    if (height != NULL)
+        *height = gGameState->targetHeight;
+}
+
+void trs_Init(SDL_Renderer *renderer, SDL_Window *window, float logicalWidth, float logicalHeight) {
+    trs_InitExt(renderer, window, logicalWidth, logicalHeight, &(trs_Config){0});
+}
+
+// Allocates everything the budgets cover up front so frames don't need to
+static void trs_PreallocateBudgets() {
+    trs_Config *config = &gGameState->config;
+    if (config->maxTriangles > 0) {
+        trs_TriangleListGuaranteeAdditional(&gGameState->triangleList, config->maxTriangles * 3);
+        trs_TriangleListGuaranteeAdditional(&gGameState->backbuffer, config->maxTriangles * 3);
+        gGameState->sortOrderSize = config->maxTriangles;
+        gGameState->sortOrder = trs_CheckMem(malloc(sizeof(int) * gGameState->sortOrderSize));
+    }
+    if (config->maxInstances > 0) {
+        gGameState->instanceSize = config->maxInstances;
+        gGameState->instances = trs_CheckMem(malloc(sizeof(struct trs_Instance_t) * gGameState->instanceSize));
+    }
+    if (config->maxUIQuads > 0) {
+        trs_Batch2D *batch = &gGameState->batch;
+        batch->vertexSize = config->maxUIQuads;
+        batch->indices = trs_CheckMem(malloc(sizeof(int) * 6 * batch->vertexSize));
+        for (int i = 0; i < batch->vertexSize; i++) {
+            batch->indices[(i * 6) + 0] = (i * 4) + 0;
+            batch->indices[(i * 6) + 1] = (i * 4) + 1;
+            batch->indices[(i * 6) + 2] = (i * 4) + 2;
+            batch->indices[(i * 6) + 3] = (i * 4) + 2;
+            batch->indices[(i * 6) + 4] = (i * 4) + 3;
+            batch->indices[(i * 6) + 5] = (i * 4) + 0;
+        }
+    }
+    if (config->maxVoices > 0) {
+        gGameState->voiceSize = config->maxVoices + (config->maxVirtualVoices > 0 ? config->maxVirtualVoices : 0);
+        gGameState->voices = trs_CheckMem(malloc(sizeof(struct trs_Voice_t) * gGameState->voiceSize));
+    }
+    gGameState->occlusionDepth = trs_CheckMem(malloc(sizeof(float) * TRS_OCCLUSION_WIDTH * TRS_OCCLUSION_HEIGHT));
+}
+
+void trs_InitExt(SDL_Renderer *renderer, SDL_Window *window, float logicalWidth, float logicalHeight, trs_Config *config) {
+    // Create the game state and target texture
+    gGameState = trs_CheckMem(calloc(1, sizeof(struct trs_GameState_t)));
+    gGameState->config = *config;
+    gGameState->renderer = renderer;
+    gGameState->window = window;
+    gGameState->logicalWidth = logicalWidth;
+    gGameState->logicalHeight = logicalHeight;
+    gGameState->renderWidth = logicalWidth;
+    gGameState->renderHeight = logicalHeight;
+    gGameState->target = SDL_CreateTexture(renderer, SDL_GetWindowPixelFormat(window), SDL_TEXTUREACCESS_TARGET, logicalWidth, logicalHeight);
+    trs_CheckSDL(gGameState->target);
+    trs_ResizeTarget(logicalWidth, logicalHeight);
+    gGameState->frameArena = trs_CreateArena(config->frameArenaSize > 0 ? config->frameArenaSize : TRS_FRAME_ARENA_SIZE);
+    trs_PreallocateBudgets();
+
+    // Cute sound, the game still runs without an audio device
+    if (!trs_InitAudio(config))
+        fprintf(stderr, "Audio is disabled.\n");
+
+    // Perspective matrix
+    gGameState->farPlane = TRS_FAR_PLANE;
+    trs_UpdatePerspective();
+
+    // Load uv texture
+    gGameState->uvtexture = trs_LoadImage("res/textures.png");
+
+    // White pixel for untextured 2D geometry
+    uint32_t *white = trs_CheckMem(malloc(sizeof(uint32_t)));
+    *white = 0xffffffff;
+    gGameState->whiteImage = trs_CreateImage(white, 1, 1);
+}
+
+void trs_End() {
+    cs_stop_all_playing_sounds();
+    trs_RasterizerDestroy(&gGameState->rasterizer);
+    for (int i = 0; i < gGameState->materialTextureCount; i++) {
+        trs_FreeImage(gGameState->materialTextures[i].image);
+        free(gGameState->materialTextures[i].filename);
+    }
+    free(gGameState->materialTextures);
+    trs_FreeImage(gGameState->uvtexture);
+    trs_FreeImage(gGameState->whiteImage);
+    while (gGameState->imageCount > 0)
+        trs_FreeImage(gGameState->images[0]);
+    free(gGameState->images);
+    for (int i = 0; i < gGameState->atlasPageCount; i++)
+        trs_DestroyTextureRGBA(gGameState->atlasPages[i]);
+    free(gGameState->atlasPages);
+    free(gGameState->texturePixels);
+    if (gGameState->renderTarget != gGameState->target)
+        SDL_DestroyTexture(gGameState->renderTarget);
+    SDL_DestroyTexture(gGameState->target);
+    if (gGameState->frameCache != NULL)
+        SDL_DestroyTexture(gGameState->frameCache);
+    trs_TriangleListEmpty(&gGameState->triangleList);
+    trs_TriangleListEmpty(&gGameState->backbuffer);
+    free(gGameState->instances);
+    free(gGameState->bsps);
+    free(gGameState->occlusionDepth);
+    free(gGameState->batch.indices);
+    free(gGameState->sortOrder);
+    free(gGameState->voices);
+    trs_FreeArena(gGameState->frameArena);
+}
+
+void trs_BeginFrame() {
+    trs_GovernorUpdate();
+    trs_UpdateAudio();
+    trs_UpdateVoices();
+    trs_TriangleListReset(&gGameState->triangleList);
+    gGameState->instanceCount = 0;
+    gGameState->triangleIdCount = 0;
+    gGameState->bspCount = 0;
+
+    // Everything in the frame arena goes, including anything the 2D batch didn't flush
+    trs_ArenaReset(gGameState->frameArena);
+    gGameState->batch.items = NULL;
+    gGameState->batch.count = 0;
+    gGameState->batch.size = 0;
+    if (gGameState->config.maxUIQuads > 0) {
+        gGameState->batch.size = gGameState->config.maxUIQuads;
+        gGameState->batch.items = trs_FrameAlloc(sizeof(struct trs_Batch2DItem_t) * gGameState->batch.size);
+    }
+}
+
+bool trs_InFrustrum(vec4 *frustum, vec4 point) {
+    for (int i = 0; i < 6; i++) {
+        if (glm_vec4_dot(frustum[i], point) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Goes through the triangle list and builds the backbuffer with all the triangles within the camera frustrum
+void trs_FrustumCull(mat4 viewproj) {
+    // Make sure the backbuffer can handle the potential new triangles
     trs_TriangleListReset(&gGameState->backbuffer);
+    trs_TriangleListGuaranteeAdditional(&gGameState->backbuffer, gGameState->triangleList.count);
 
     // Get and normalize planes
     vec4 planes[6];
@@ -512,6 +2420,7 @@ void trs_FrustumCull(mat4 viewproj) {
             gGameState->backbuffer.vertices[gGameState->backbuffer.count] = gGameState->triangleList.vertices[startingVertex];
             gGameState->backbuffer.vertices[gGameState->backbuffer.count + 1] = gGameState->triangleList.vertices[startingVertex + 1];
             gGameState->backbuffer.vertices[gGameState->backbuffer.count + 2] = gGameState->triangleList.vertices[startingVertex + 2];
+            gGameState->backbuffer.info[gGameState->backbuffer.count / 3] = gGameState->triangleList.info[startingVertex / 3];
             gGameState->backbuffer.count += 3;
         }
 
@@ -526,10 +2435,40 @@ void trs_FrustumCull(mat4 viewproj) {
         gGameState->backbuffer.vertices[gGameState->backbuffer.count] = gGameState->triangleList.vertices[startingVertex];
         gGameState->backbuffer.vertices[gGameState->backbuffer.count + 1] = gGameState->triangleList.vertices[startingVertex + 1];
         gGameState->backbuffer.vertices[gGameState->backbuffer.count + 2] = gGameState->triangleList.vertices[startingVertex + 2];
+        gGameState->backbuffer.info[gGameState->backbuffer.count / 3] = gGameState->triangleList.info[startingVertex / 3];
         gGameState->backbuffer.count += 3;
     }
 }
 
+// Removes triangles facing the wrong way for their cull mode from a list of clip-space triangles,
+// counter-clockwise in ndc is the front
+static void trs_BackfaceCull(trs_TriangleList *list) {
+    int kept = 0;
+    for (int tri = 0; tri < list->count / 3; tri++) {
+        trs_Vertex *v = &list->vertices[tri * 3];
+        const trs_CullMode cullMode = list->info[tri].cullMode;
+
+        // Triangles with a vertex behind the camera don't have a meaningful winding on screen
+        if (cullMode != TRS_CULL_NONE && v[0].position[3] > 0 && v[1].position[3] > 0 && v[2].position[3] > 0) {
+            const float x0 = v[0].position[0] / v[0].position[3], y0 = v[0].position[1] / v[0].position[3];
+            const float x1 = v[1].position[0] / v[1].position[3], y1 = v[1].position[1] / v[1].position[3];
+            const float x2 = v[2].position[0] / v[2].position[3], y2 = v[2].position[1] / v[2].position[3];
+            const float area = ((x1 - x0) * (y2 - y0)) - ((x2 - x0) * (y1 - y0));
+            if ((cullMode == TRS_CULL_BACK && area <= 0) || (cullMode == TRS_CULL_FRONT && area >= 0))
+                continue;
+        }
+
+        if (kept != tri) {
+            list->vertices[(kept * 3) + 0] = v[0];
+            list->vertices[(kept * 3) + 1] = v[1];
+            list->vertices[(kept * 3) + 2] = v[2];
+            list->info[kept] = list->info[tri];
+        }
+        kept++;
+    }
+    list->count = kept * 3;
+}
+
 // Returns of the lowest of three inputs
 static float lowestThree(float x, float y, float z) {
     if (x < y && x < z)
@@ -546,6 +2485,138 @@ int comp(const void *val1, const void *val2) {
     return triangle1->averageDepth > triangle2->averageDepth && triangle1->averageDepth > triangle2->lowestDepth ? -1 : 1;
 }
 
+// Comparison for grouping textures within depth buckets, keeping the painter's order otherwise
+static int trs_BucketComp(const void *val1, const void *val2) {
+    const trs_TriangleDepth *triangle1 = val1;
+    const trs_TriangleDepth *triangle2 = val2;
+    if (triangle1->bucket != triangle2->bucket)
+        return triangle1->bucket < triangle2->bucket ? -1 : 1;
+    if (triangle1->texture != triangle2->texture)
+        return (uintptr_t)triangle1->texture < (uintptr_t)triangle2->texture ? -1 : 1;
+    return triangle1->order < triangle2->order ? -1 : 1;
+}
+
+// Regroups triangles of similar depth by texture so more of them can be drawn together, this trades
+// some ordering accuracy inside each bucket for fewer draw calls
+static void trs_TextureBucketSort(trs_TriangleDepth *triangleDepths, int count) {
+    if (count == 0)
+        return;
+    float nearest = triangleDepths[0].averageDepth;
+    float furthest = triangleDepths[0].averageDepth;
+    for (int i = 0; i < count; i++) {
+        if (triangleDepths[i].averageDepth < nearest)
+            nearest = triangleDepths[i].averageDepth;
+        if (triangleDepths[i].averageDepth > furthest)
+            furthest = triangleDepths[i].averageDepth;
+    }
+
+    // Bucket 0 is the furthest slice like the painter's order, and a bucket never goes below the one before
+    // it so the heuristic sort's occasional out of order triangle can't be sent to another part of the frame
+    const float range = furthest - nearest > 0 ? furthest - nearest : 1;
+    int previousBucket = 0;
+    for (int i = 0; i < count; i++) {
+        int bucket = (int)(((furthest - triangleDepths[i].averageDepth) / range) * gGameState->textureSortBuckets);
+        if (bucket < previousBucket)
+            bucket = previousBucket;
+        triangleDepths[i].bucket = bucket;
+        triangleDepths[i].order = i;
+        previousBucket = bucket;
+    }
+    qsort(triangleDepths, count, sizeof(struct trs_TriangleDepth_t), trs_BucketComp);
+}
+
+// Returns true if the camera moved too far since the last sort for the old order to be worth reusing
+static bool trs_SortCameraCut() {
+    trs_Camera *camera = &gGameState->camera;
+    trs_Camera *previous = &gGameState->sortCamera;
+    float angle = fabsf(remainderf(camera->rotation - previous->rotation, GLM_PI * 2));
+    return gGameState->cameraCut ||
+           glm_vec3_distance(camera->eyes, previous->eyes) > TRS_SORT_CUT_DISTANCE ||
+           angle > TRS_SORT_CUT_ANGLE ||
+           fabsf(camera->rotationZ - previous->rotationZ) > TRS_SORT_CUT_ANGLE;
+}
+
+// Puts the depth list in last frame's order, triangles that weren't drawn last frame go on the end
+static void trs_ApplyPreviousOrder(trs_TriangleDepth *triangleDepths, int count) {
+    // Triangle id -> index in this frame's depth list, -1 if it isn't in it
+    int *slots = trs_FrameAlloc(sizeof(int) * gGameState->triangleIdCount);
+    for (int i = 0; i < gGameState->triangleIdCount; i++)
+        slots[i] = -1;
+    for (int i = 0; i < count; i++)
+        slots[triangleDepths[i].id] = i;
+
+    trs_TriangleDepth *ordered = trs_FrameAlloc(sizeof(struct trs_TriangleDepth_t) * count);
+    int orderedCount = 0;
+    for (int i = 0; i < gGameState->sortOrderCount; i++) {
+        const int id = gGameState->sortOrder[i];
+        if (id < gGameState->triangleIdCount && slots[id] != -1) {
+            ordered[orderedCount++] = triangleDepths[slots[id]];
+            slots[id] = -1;
+        }
+    }
+    for (int i = 0; i < count; i++)
+        if (slots[triangleDepths[i].id] != -1)
+            ordered[orderedCount++] = triangleDepths[i];
+    memcpy(triangleDepths, ordered, sizeof(struct trs_TriangleDepth_t) * count);
+}
+
+// Insertion sort that is close to linear on nearly sorted input, returns false without finishing if
+// it had to shift more than moveLimit triangles in total
+static bool trs_AdaptiveSort(trs_TriangleDepth *triangleDepths, int count, int moveLimit) {
+    int moves = 0;
+    for (int i = 1; i < count; i++) {
+        if (comp(&triangleDepths[i], &triangleDepths[i - 1]) >= 0)
+            continue;
+        trs_TriangleDepth triangle = triangleDepths[i];
+        int j = i;
+        while (j > 0 && comp(&triangle, &triangleDepths[j - 1]) < 0) {
+            triangleDepths[j] = triangleDepths[j - 1];
+            j--;
+        }
+        triangleDepths[j] = triangle;
+        moves += i - j;
+        if (moves > moveLimit)
+            return false;
+    }
+    return true;
+}
+
+// Painter's sort that reuses the previous frame's order when the camera moved smoothly, ids must be unique
+// and below triangleIdCount
+static void trs_TemporalSort(trs_TriangleDepth *triangleDepths, int count) {
+    bool sorted = false;
+    if (!trs_SortCameraCut()) {
+        trs_ApplyPreviousOrder(triangleDepths, count);
+        sorted = trs_AdaptiveSort(triangleDepths, count, count * TRS_SORT_MOVE_LIMIT);
+    }
+    if (!sorted) {
+        qsort(triangleDepths, count, sizeof(struct trs_TriangleDepth_t), comp);
+        gGameState->fullSortCount++;
+    }
+
+    // Remember this order for next frame
+    if (gGameState->sortOrderSize < count) {
+        gGameState->sortOrderSize = count * 2;
+        gGameState->sortOrder = trs_CheckMem(realloc(gGameState->sortOrder, sizeof(int) * gGameState->sortOrderSize));
+    }
+    for (int i = 0; i < count; i++)
+        gGameState->sortOrder[i] = triangleDepths[i].id;
+    gGameState->sortOrderCount = count;
+    gGameState->sortCamera = gGameState->camera;
+    gGameState->cameraCut = false;
+}
+
+// Merges two back to front lists of triangles into one
+static void trs_MergeDepths(trs_TriangleDepth *list1, int count1, trs_TriangleDepth *list2, int count2, trs_TriangleDepth *out) {
+    int i1 = 0, i2 = 0;
+    for (int i = 0; i < count1 + count2; i++) {
+        if (i2 == count2 || (i1 < count1 && comp(&list1[i1], &list2[i2]) < 0))
+            out[i] = list1[i1++];
+        else
+            out[i] = list2[i2++];
+    }
+}
+
 // Resets the front buffer and builds it back from the backbuffer in order of the painters algorithm
 void trs_PaintersAlgorithm() {
     // Make sure the front buffer is of the right soul
@@ -553,16 +2624,56 @@ void trs_PaintersAlgorithm() {
     gGameState->triangleList.count = gGameState->backbuffer.count;
     gTriangleCount = gGameState->triangleList.count / 3;
 
-    // Create triangle depth list
-    trs_TriangleDepth *triangleDepths = trs_CheckMem(calloc(gGameState->backbuffer.count / 3, sizeof(struct trs_TriangleDepth_t)));
-    for (int i = 0; i < gGameState->backbuffer.count / 3; i++) {
-        triangleDepths[i].averageDepth = (gGameState->backbuffer.vertices[i * 3].position[2] + gGameState->backbuffer.vertices[(i * 3) + 1].position[2] + gGameState->backbuffer.vertices[(i * 3) + 2].position[2]) / 3;
-        triangleDepths[i].lowestDepth = lowestThree(gGameState->backbuffer.vertices[i * 3].position[2], gGameState->backbuffer.vertices[(i * 3) + 1].position[2], gGameState->backbuffer.vertices[(i * 3) + 2].position[2]);
-        triangleDepths[i].index = i;
+    // Create triangle depth lists, one per stream
+    const int count = gGameState->backbuffer.count / 3;
+    const int streamCount = TRS_STREAM_BSP + gGameState->bspCount;
+    trs_TriangleDepth **streams = trs_FrameAlloc(sizeof(trs_TriangleDepth*) * streamCount);
+    int *streamCounts = trs_FrameAlloc(sizeof(int) * streamCount);
+    memset(streamCounts, 0, sizeof(int) * streamCount);
+    for (int i = 0; i < count; i++)
+        streamCounts[gGameState->backbuffer.info[i].stream]++;
+    for (int i = 0; i < streamCount; i++) {
+        streams[i] = trs_FrameAlloc(sizeof(struct trs_TriangleDepth_t) * (streamCounts[i] + 1));
+        streamCounts[i] = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        const int stream = gGameState->backbuffer.info[i].stream;
+        trs_TriangleDepth *depth = &streams[stream][streamCounts[stream]++];
+        depth->averageDepth = (gGameState->backbuffer.vertices[i * 3].position[2] + gGameState->backbuffer.vertices[(i * 3) + 1].position[2] + gGameState->backbuffer.vertices[(i * 3) + 2].position[2]) / 3;
+        depth->lowestDepth = lowestThree(gGameState->backbuffer.vertices[i * 3].position[2], gGameState->backbuffer.vertices[(i * 3) + 1].position[2], gGameState->backbuffer.vertices[(i * 3) + 2].position[2]);
+        depth->index = i;
+        depth->id = gGameState->backbuffer.info[i].id;
+        depth->texture = gGameState->backbuffer.info[i].texture;
+
+        // Instances are in order of their own depth, not their triangles'
+        if (stream == TRS_STREAM_INSTANCES) {
+            depth->averageDepth = gGameState->backbuffer.info[i].streamDepth;
+            depth->lowestDepth = depth->averageDepth;
+        }
+    }
+
+    // Sort, in instance mode the temporal sort was spent on the instances
+    trs_TriangleDepth *triangleDepths = streams[TRS_STREAM_SORTED];
+    if (gGameState->temporalSort && gGameState->sortMode == TRS_SORT_TRIANGLES)
+        trs_TemporalSort(triangleDepths, streamCounts[TRS_STREAM_SORTED]);
+    else
+        qsort(triangleDepths, streamCounts[TRS_STREAM_SORTED], sizeof(struct trs_TriangleDepth_t), comp);
+
+    // Merge the already ordered streams in
+    trs_TriangleDepth *merged = trs_FrameAlloc(sizeof(struct trs_TriangleDepth_t) * count);
+    int mergedCount = streamCounts[TRS_STREAM_SORTED];
+    for (int stream = TRS_STREAM_SORTED + 1; stream < streamCount; stream++) {
+        if (streamCounts[stream] == 0)
+            continue;
+        trs_MergeDepths(triangleDepths, mergedCount, streams[stream], streamCounts[stream], merged);
+        trs_TriangleDepth *temp = triangleDepths;
+        triangleDepths = merged;
+        merged = temp;
+        mergedCount += streamCounts[stream];
     }
 
-    // Sort
-    qsort(triangleDepths, gGameState->backbuffer.count / 3, sizeof(struct trs_TriangleDepth_t), comp);
+    if (gGameState->textureSortBuckets > 0)
+        trs_TextureBucketSort(triangleDepths, gGameState->backbuffer.count / 3);
 
     // Copy sorted triangles to triangle list
     for (int i = 0; i < gGameState->backbuffer.count / 3; i++) {
@@ -570,11 +2681,818 @@ void trs_PaintersAlgorithm() {
         gGameState->triangleList.vertices[i * 3] = gGameState->backbuffer.vertices[tri * 3];
         gGameState->triangleList.vertices[(i * 3) + 1] = gGameState->backbuffer.vertices[(tri * 3) + 1];
         gGameState->triangleList.vertices[(i * 3) + 2] = gGameState->backbuffer.vertices[(tri * 3) + 2];
+        gGameState->triangleList.info[i] = gGameState->backbuffer.info[tri];
+    }
+}
+
+//----------------- BSP -----------------//
+// Static geometry is put into a BSP tree once, then walking the tree from the eye gives its triangles
+// in back to front order without any sorting. Triangles crossing a splitting plane are cut in two so
+// the order is exact. Only dynamic instances are depth sorted and merged in with the tree's triangles.
+
+trs_BSP trs_CreateBSP() {
+    trs_BSP bsp = trs_CheckMem(calloc(1, sizeof(struct trs_BSP_t)));
+    bsp->root = -1;
+    return bsp;
+}
+
+// Adds a triangle to one of the bsp's triangle lists
+static void trs_BSPPush(trs_BSPTriangle **list, int *count, int *size, trs_BSPTriangle *triangle) {
+    if (*count == *size) {
+        *size = *size == 0 ? 64 : *size * 2;
+        *list = trs_CheckMem(realloc(*list, sizeof(struct trs_BSPTriangle_t) * (*size)));
+    }
+    (*list)[(*count)++] = *triangle;
+}
+
+void trs_BSPAddModel(trs_BSP bsp, trs_Model model, mat4 modelMatrix) {
+    trs_CullMode cullMode = model->cullMode;
+    vec3 cross;
+    glm_vec3_cross(modelMatrix[1], modelMatrix[2], cross);
+    if (glm_vec3_dot(modelMatrix[0], cross) < 0 && cullMode != TRS_CULL_NONE)
+        cullMode = cullMode == TRS_CULL_BACK ? TRS_CULL_FRONT : TRS_CULL_BACK;
+
+    for (int group = 0; group < model->groupCount; group++) {
+        for (int i = 0; i < model->groups[group].count; i += 3) {
+            trs_BSPTriangle triangle;
+            triangle.texture = model->groups[group].texture;
+            triangle.cullMode = cullMode;
+            triangle.occluder = model->occluder;
+            for (int j = 0; j < 3; j++) {
+                triangle.vertices[j] = model->vertices[model->groups[group].first + i + j];
+                glm_mat4_mulv(modelMatrix, triangle.vertices[j].position, triangle.vertices[j].position);
+            }
+
+            // Degenerate triangles don't have a plane
+            vec3 edge1, edge2;
+            glm_vec3_sub(triangle.vertices[1].position, triangle.vertices[0].position, edge1);
+            glm_vec3_sub(triangle.vertices[2].position, triangle.vertices[0].position, edge2);
+            glm_vec3_cross(edge1, edge2, cross);
+            if (glm_vec3_norm2(cross) > 0)
+                trs_BSPPush(&bsp->input, &bsp->inputCount, &bsp->inputSize, &triangle);
+        }
+    }
+}
+
+// Plane of a triangle as normal and distance
+static void trs_BSPTrianglePlane(trs_BSPTriangle *triangle, vec4 plane) {
+    vec3 edge1, edge2;
+    glm_vec3_sub(triangle->vertices[1].position, triangle->vertices[0].position, edge1);
+    glm_vec3_sub(triangle->vertices[2].position, triangle->vertices[0].position, edge2);
+    glm_vec3_cross(edge1, edge2, plane);
+    glm_vec3_normalize(plane);
+    plane[3] = -glm_vec3_dot(plane, triangle->vertices[0].position);
+}
+
+static float trs_BSPDistance(vec4 plane, vec4 position) {
+    return glm_vec3_dot(plane, position) + plane[3];
+}
+
+// Returns -1 if the triangle is behind the plane, 1 in front, 0 on it and 2 if it crosses it
+static int trs_BSPClassify(vec4 plane, trs_BSPTriangle *triangle) {
+    bool front = false, back = false;
+    for (int i = 0; i < 3; i++) {
+        const float distance = trs_BSPDistance(plane, triangle->vertices[i].position);
+        if (distance > TRS_BSP_EPSILON)
+            front = true;
+        else if (distance < -TRS_BSP_EPSILON)
+            back = true;
+    }
+    if (front && back)
+        return 2;
+    return front ? 1 : (back ? -1 : 0);
+}
+
+// Cuts a triangle by a plane into up to three triangles on either side
+static void trs_BSPSplit(vec4 plane, trs_BSPTriangle *triangle, trs_BSPTriangle *front, int *frontCount, trs_BSPTriangle *back, int *backCount) {
+    trs_Vertex frontPoly[4], backPoly[4];
+    int frontVerts = 0, backVerts = 0;
+    for (int i = 0; i < 3; i++) {
+        trs_Vertex *v1 = &triangle->vertices[i];
+        trs_Vertex *v2 = &triangle->vertices[(i + 1) % 3];
+        const float d1 = trs_BSPDistance(plane, v1->position);
+        const float d2 = trs_BSPDistance(plane, v2->position);
+        if (d1 >= -TRS_BSP_EPSILON)
+            frontPoly[frontVerts++] = *v1;
+        if (d1 <= TRS_BSP_EPSILON)
+            backPoly[backVerts++] = *v1;
+
+        // Edge goes from one side to the other
+        if ((d1 > TRS_BSP_EPSILON && d2 < -TRS_BSP_EPSILON) || (d1 < -TRS_BSP_EPSILON && d2 > TRS_BSP_EPSILON)) {
+            const float t = d1 / (d1 - d2);
+            trs_Vertex cut;
+            glm_vec4_lerp(v1->position, v2->position, t, cut.position);
+            glm_vec2_lerp(v1->uv, v2->uv, t, cut.uv);
+            frontPoly[frontVerts++] = cut;
+            backPoly[backVerts++] = cut;
+        }
+    }
+
+    // Fan the polygons back into triangles
+    *frontCount = 0;
+    *backCount = 0;
+    for (int i = 1; i + 1 < frontVerts; i++) {
+        front[*frontCount] = *triangle;
+        front[*frontCount].vertices[0] = frontPoly[0];
+        front[*frontCount].vertices[1] = frontPoly[i];
+        front[*frontCount].vertices[2] = frontPoly[i + 1];
+        (*frontCount)++;
+    }
+    for (int i = 1; i + 1 < backVerts; i++) {
+        back[*backCount] = *triangle;
+        back[*backCount].vertices[0] = backPoly[0];
+        back[*backCount].vertices[1] = backPoly[i];
+        back[*backCount].vertices[2] = backPoly[i + 1];
+        (*backCount)++;
+    }
+}
+
+// Picks the splitter out of a sample of the triangles that cuts the fewest others and keeps the sides even
+static int trs_BSPChooseSplitter(trs_BSPTriangle *triangles, int count) {
+    const int step = count > TRS_BSP_CANDIDATES ? count / TRS_BSP_CANDIDATES : 1;
+    int best = 0;
+    int bestScore = INT_MAX;
+    for (int candidate = 0; candidate < count; candidate += step) {
+        vec4 plane;
+        trs_BSPTrianglePlane(&triangles[candidate], plane);
+        int splits = 0, front = 0, back = 0;
+        for (int i = 0; i < count; i++) {
+            const int side = trs_BSPClassify(plane, &triangles[i]);
+            splits += side == 2;
+            front += side == 1;
+            back += side == -1;
+        }
+        const int score = (splits * 8) + abs(front - back);
+        if (score < bestScore) {
+            bestScore = score;
+            best = candidate;
+        }
+    }
+    return best;
+}
+
+// Builds a subtree out of a list of triangles and returns its node, or -1 for an empty list
+static int trs_BSPBuildNode(trs_BSP bsp, trs_BSPTriangle *triangles, int count) {
+    if (count == 0)
+        return -1;
+
+    // Reserve the node first since building the children moves the node list
+    if (bsp->nodeCount == bsp->nodeSize) {
+        bsp->nodeSize = bsp->nodeSize == 0 ? 64 : bsp->nodeSize * 2;
+        bsp->nodes = trs_CheckMem(realloc(bsp->nodes, sizeof(struct trs_BSPNode_t) * bsp->nodeSize));
+    }
+    const int node = bsp->nodeCount++;
+    vec4 plane;
+    trs_BSPTrianglePlane(&triangles[trs_BSPChooseSplitter(triangles, count)], plane);
+    glm_vec4_copy(plane, bsp->nodes[node].plane);
+    bsp->nodes[node].first = bsp->triangleCount;
+
+    // Sort the triangles to either side of the plane
+    trs_BSPTriangle *front = NULL, *back = NULL;
+    int frontCount = 0, frontSize = 0, backCount = 0, backSize = 0;
+    for (int i = 0; i < count; i++) {
+        const int side = trs_BSPClassify(plane, &triangles[i]);
+        if (side == 0) {
+            trs_BSPPush(&bsp->triangles, &bsp->triangleCount, &bsp->triangleSize, &triangles[i]);
+        } else if (side == 1) {
+            trs_BSPPush(&front, &frontCount, &frontSize, &triangles[i]);
+        } else if (side == -1) {
+            trs_BSPPush(&back, &backCount, &backSize, &triangles[i]);
+        } else {
+            trs_BSPTriangle frontCut[2], backCut[2];
+            int frontCuts, backCuts;
+            trs_BSPSplit(plane, &triangles[i], frontCut, &frontCuts, backCut, &backCuts);
+            for (int j = 0; j < frontCuts; j++)
+                trs_BSPPush(&front, &frontCount, &frontSize, &frontCut[j]);
+            for (int j = 0; j < backCuts; j++)
+                trs_BSPPush(&back, &backCount, &backSize, &backCut[j]);
+        }
+    }
+    bsp->nodes[node].count = bsp->triangleCount - bsp->nodes[node].first;
+
+    const int frontNode = trs_BSPBuildNode(bsp, front, frontCount);
+    free(front);
+    const int backNode = trs_BSPBuildNode(bsp, back, backCount);
+    free(back);
+    bsp->nodes[node].front = frontNode;
+    bsp->nodes[node].back = backNode;
+    return node;
+}
+
+void trs_BSPBuild(trs_BSP bsp) {
+    bsp->nodeCount = 0;
+    bsp->triangleCount = 0;
+    bsp->root = trs_BSPBuildNode(bsp, bsp->input, bsp->inputCount);
+    trs_InvalidateFrame();
+}
+
+void trs_DrawBSP(trs_BSP bsp) {
+    if (gGameState->bspCount == gGameState->bspSize) {
+        gGameState->bspSize = gGameState->bspSize == 0 ? 8 : gGameState->bspSize * 2;
+        gGameState->bsps = trs_CheckMem(realloc(gGameState->bsps, sizeof(trs_BSP) * gGameState->bspSize));
+    }
+    gGameState->bsps[gGameState->bspCount++] = bsp;
+}
+
+// Copies a node's triangles to the triangle list, marked as already ordered in their bsp's stream
+static void trs_BSPEmitNode(trs_BSP bsp, trs_BSPNode *node, int stream) {
+    trs_TriangleList *list = &gGameState->triangleList;
+    if (!trs_FitsTriangleBudget(node->count))
+        return;
+    trs_TriangleListGuaranteeAdditional(list, node->count * 3);
+    for (int i = node->first; i < node->first + node->count; i++) {
+        trs_BSPTriangle *triangle = &bsp->triangles[i];
+        trs_Image texture = triangle->texture != NULL ? triangle->texture : gGameState->uvtexture;
+        for (int j = 0; j < 3; j++) {
+            trs_Vertex *vertex = &list->vertices[list->count + j];
+            *vertex = triangle->vertices[j];
+            vertex->uv[0] = texture->uvOffset[0] + (vertex->uv[0] * texture->uvScale[0]);
+            vertex->uv[1] = texture->uvOffset[1] + (vertex->uv[1] * texture->uvScale[1]);
+        }
+        trs_TriangleInfo *info = &list->info[list->count / 3];
+        info->texture = texture->texture;
+        info->cullMode = triangle->cullMode;
+        info->id = gGameState->triangleIdCount++;
+        info->stream = stream;
+        list->count += 3;
+    }
+}
+
+// Walks the tree so whatever is on the far side of each plane from the eye comes first
+static void trs_BSPTraverse(trs_BSP bsp, int node, vec3 eye, int stream) {
+    if (node == -1)
+        return;
+    trs_BSPNode *current = &bsp->nodes[node];
+    if (trs_BSPDistance(current->plane, eye) >= 0) {
+        trs_BSPTraverse(bsp, current->back, eye, stream);
+        trs_BSPEmitNode(bsp, current, stream);
+        trs_BSPTraverse(bsp, current->front, eye, stream);
+    } else {
+        trs_BSPTraverse(bsp, current->front, eye, stream);
+        trs_BSPEmitNode(bsp, current, stream);
+        trs_BSPTraverse(bsp, current->back, eye, stream);
+    }
+}
+
+// Adds the bsps drawn this frame to the triangle list, each in back to front order for the camera as
+// its own stream so the painter's algorithm merges them by depth
+static void trs_ExpandBSP() {
+    for (int i = 0; i < gGameState->bspCount; i++) {
+        trs_BSP bsp = gGameState->bsps[i];
+        if (bsp != NULL && bsp->root != -1)
+            trs_BSPTraverse(bsp, bsp->root, gGameState->camera.eyes, TRS_STREAM_BSP + i);
+    }
+}
+
+void trs_FreeBSP(trs_BSP bsp) {
+    if (bsp != NULL) {
+        for (int i = 0; i < gGameState->bspCount; i++)
+            if (gGameState->bsps[i] == bsp)
+                gGameState->bsps[i] = NULL;
+        free(bsp->input);
+        free(bsp->triangles);
+        free(bsp->nodes);
+        free(bsp);
+    }
+}
+
+//----------------- Occlusion Culling -----------------//
+// Models marked as occluders, drawn as instances or as part of a bsp, are rasterized into a tiny depth
+// buffer, then any instance whose screen-space bounds are entirely behind what's in the buffer is
+// skipped before it becomes triangles.
+
+// Converts a clip-space position to occlusion buffer coordinates
+static void trs_OcclusionProject(vec4 clip, float *x, float *y, float *z) {
+    *x = (TRS_OCCLUSION_WIDTH / 2.0f) + ((clip[0] / clip[3]) * (TRS_OCCLUSION_WIDTH / 2.0f));
+    *y = (TRS_OCCLUSION_HEIGHT / 2.0f) + ((clip[1] / clip[3]) * (TRS_OCCLUSION_HEIGHT / 2.0f));
+    *z = clip[2] / clip[3];
+}
+
+// Rasterizes an occluder triangle at its furthest depth so the buffer never claims more than is hidden
+static void trs_OcclusionRasterTriangle(vec4 *clip) {
+    float x[3], y[3], z[3];
+    for (int i = 0; i < 3; i++) {
+        if (clip[i][2] < -clip[i][3]) // crosses the near plane
+            return;
+        trs_OcclusionProject(clip[i], &x[i], &y[i], &z[i]);
+    }
+    const float depth = z[0] > z[1] ? (z[0] > z[2] ? z[0] : z[2]) : (z[1] > z[2] ? z[1] : z[2]);
+    const float area = ((x[1] - x[0]) * (y[2] - y[0])) - ((x[2] - x[0]) * (y[1] - y[0]));
+    if (area == 0)
+        return;
+    const float sign = area > 0 ? 1 : -1;
+
+    // Bounds
+    const int minX = clamp(floorf(fminf(x[0], fminf(x[1], x[2]))), 0, TRS_OCCLUSION_WIDTH - 1);
+    const int maxX = clamp(ceilf(fmaxf(x[0], fmaxf(x[1], x[2]))), 0, TRS_OCCLUSION_WIDTH - 1);
+    const int minY = clamp(floorf(fminf(y[0], fminf(y[1], y[2]))), 0, TRS_OCCLUSION_HEIGHT - 1);
+    const int maxY = clamp(ceilf(fmaxf(y[0], fmaxf(y[1], y[2]))), 0, TRS_OCCLUSION_HEIGHT - 1);
+
+    // Pixel centers inside all three edges get covered
+    for (int py = minY; py <= maxY; py++) {
+        for (int px = minX; px <= maxX; px++) {
+            bool inside = true;
+            for (int i = 0; i < 3 && inside; i++) {
+                const int j = (i + 1) % 3;
+                const float edge = ((x[j] - x[i]) * ((py + 0.5f) - y[i])) - ((y[j] - y[i]) * ((px + 0.5f) - x[i]));
+                inside = edge * sign > 0;
+            }
+            float *pixel = &gGameState->occlusionDepth[(py * TRS_OCCLUSION_WIDTH) + px];
+            if (inside && depth < *pixel)
+                *pixel = depth;
+        }
+    }
+}
+
+// Returns true if the instance's bounding box is off screen or behind the occluders
+static bool trs_OcclusionHidden(trs_Instance *instance, mat4 vp) {
+    mat4 mvp;
+    glm_mat4_mul(vp, instance->matrix, mvp);
+    trs_Hitbox box = instance->model->hitbox;
+
+    // Project all 8 corners of the bounding box
+    float minX = FLT_MAX, minY = FLT_MAX, nearest = FLT_MAX;
+    float maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (int i = 0; i < 8; i++) {
+        vec4 corner = {box->box[i & 1][0], box->box[(i >> 1) & 1][1], box->box[(i >> 2) & 1][2], 1};
+        glm_mat4_mulv(mvp, corner, corner);
+        if (corner[2] < -corner[3]) // too close to the camera to say anything
+            return false;
+        float x, y, z;
+        trs_OcclusionProject(corner, &x, &y, &z);
+        minX = x < minX ? x : minX;
+        maxX = x > maxX ? x : maxX;
+        minY = y < minY ? y : minY;
+        maxY = y > maxY ? y : maxY;
+        nearest = z < nearest ? z : nearest;
+    }
+    if (maxX < 0 || maxY < 0 || minX >= TRS_OCCLUSION_WIDTH || minY >= TRS_OCCLUSION_HEIGHT)
+        return true;
+
+    // Hidden only if every pixel it could touch has an occluder in front of it
+    const int x1 = clamp(floorf(minX), 0, TRS_OCCLUSION_WIDTH - 1);
+    const int x2 = clamp(ceilf(maxX), 0, TRS_OCCLUSION_WIDTH - 1);
+    const int y1 = clamp(floorf(minY), 0, TRS_OCCLUSION_HEIGHT - 1);
+    const int y2 = clamp(ceilf(maxY), 0, TRS_OCCLUSION_HEIGHT - 1);
+    for (int y = y1; y <= y2; y++)
+        for (int x = x1; x <= x2; x++)
+            if (gGameState->occlusionDepth[(y * TRS_OCCLUSION_WIDTH) + x] >= nearest)
+                return false;
+    return true;
+}
+
+// Builds the occlusion buffer from this frame's occluders, then expands every visible instance
+static void trs_OcclusionCull(mat4 vp) {
+    // Swap in each instance's level of detail before anything looks at its triangles
+    for (int i = 0; i < gGameState->instanceCount; i++)
+        gGameState->instances[i].model = trs_InstanceLOD(&gGameState->instances[i]);
+
+    for (int i = 0; i < TRS_OCCLUSION_WIDTH * TRS_OCCLUSION_HEIGHT; i++)
+        gGameState->occlusionDepth[i] = FLT_MAX;
+
+    // Occluders
+    for (int i = 0; i < gGameState->instanceCount; i++) {
+        trs_Instance *instance = &gGameState->instances[i];
+        if (!instance->model->occluder)
+            continue;
+        mat4 mvp;
+        glm_mat4_mul(vp, instance->matrix, mvp);
+        for (int vertex = 0; vertex < instance->model->count; vertex += 3) {
+            vec4 clip[3];
+            for (int j = 0; j < 3; j++)
+                glm_mat4_mulv(mvp, instance->model->vertices[vertex + j].position, clip[j]);
+            trs_OcclusionRasterTriangle(clip);
+        }
+    }
+
+    // Static occluders in this frame's bsps are already in world space
+    for (int i = 0; i < gGameState->bspCount; i++) {
+        trs_BSP bsp = gGameState->bsps[i];
+        for (int triangle = 0; bsp != NULL && triangle < bsp->triangleCount; triangle++) {
+            if (!bsp->triangles[triangle].occluder)
+                continue;
+            vec4 clip[3];
+            for (int j = 0; j < 3; j++)
+                glm_mat4_mulv(vp, bsp->triangles[triangle].vertices[j].position, clip[j]);
+            trs_OcclusionRasterTriangle(clip);
+        }
+    }
+
+    // Test and expand, hidden instances still take their ids so the ones after them don't shift
+    trs_TriangleDepth *instanceDepths = trs_FrameAlloc(sizeof(struct trs_TriangleDepth_t) * gGameState->instanceCount);
+    int visibleCount = 0;
+    gGameState->occludedCount = 0;
+    for (int i = 0; i < gGameState->instanceCount; i++) {
+        trs_Instance *instance = &gGameState->instances[i];
+        const int firstId = gGameState->triangleIdCount;
+        gGameState->triangleIdCount += instance->model->count / 3;
+        if (trs_OcclusionHidden(instance, vp)) {
+            gGameState->occludedCount++;
+        } else if (instance->model->count < 3) {
+            continue; // nothing to draw and its id would be taken by the next instance
+        } else if (gGameState->sortMode == TRS_SORT_TRIANGLES) {
+            trs_ExpandModel(instance->model, instance->matrix, firstId, NULL, TRS_STREAM_SORTED);
+        } else {
+            // Depth of the instance's centre
+            trs_Hitbox hitbox = instance->model->hitbox;
+            vec4 centre = {
+                (hitbox->box[0][0] + hitbox->box[1][0]) / 2,
+                (hitbox->box[0][1] + hitbox->box[1][1]) / 2,
+                (hitbox->box[0][2] + hitbox->box[1][2]) / 2,
+                1
+            };
+            vec4 clip;
+            glm_mat4_mulv(instance->matrix, centre, centre);
+            glm_mat4_mulv(vp, centre, clip);
+            trs_TriangleDepth *depth = &instanceDepths[visibleCount++];
+            depth->averageDepth = clip[2];
+            depth->lowestDepth = clip[2];
+            depth->index = i;
+            depth->id = firstId;
+        }
+    }
+
+    // Instance sort, each instance's triangles come out in its model's order for the view direction
+    if (gGameState->temporalSort && gGameState->sortMode == TRS_SORT_INSTANCES)
+        trs_TemporalSort(instanceDepths, visibleCount);
+    else
+        qsort(instanceDepths, visibleCount, sizeof(struct trs_TriangleDepth_t), comp);
+    trs_TriangleList *list = &gGameState->triangleList;
+    for (int i = 0; i < visibleCount; i++) {
+        trs_Instance *instance = &gGameState->instances[instanceDepths[i].index];
+        trs_Hitbox hitbox = instance->model->hitbox;
+        vec3 centre;
+        glm_vec3_add(hitbox->box[0], hitbox->box[1], centre);
+        glm_vec3_scale(centre, 0.5f, centre);
+        glm_mat4_mulv3(instance->matrix, centre, 1, centre);
+        const int first = list->count / 3;
+        trs_ExpandModel(instance->model, instance->matrix, instanceDepths[i].id, trs_InstanceSortOrder(instance, centre), TRS_STREAM_INSTANCES);
+        for (int tri = first; tri < list->count / 3; tri++)
+            list->info[tri].streamDepth = instanceDepths[i].averageDepth;
+    }
+}
+
+//----------------- Software Rasterizer -----------------//
+// Alternative to SDL_RenderGeometry that rasterizes the frame on the CPU with a depth buffer, so
+// triangles don't need to be sorted and intersecting triangles come out right. The screen is split
+// into tiles that worker threads take turns rasterizing.
+
+// Blends a texel towards the clear colour for its 1/w
+static inline uint32_t trs_RasterFog(const trs_Rasterizer *raster, uint32_t texel, float invW) {
+    const float amount = trs_FogAmount(1 / invW, raster->fogStart, raster->fogEnd);
+    if (amount == 0)
+        return texel;
+    uint8_t *channels = (uint8_t*)&texel;
+    const uint8_t *clear = (const uint8_t*)&(uint32_t){TRS_CLEAR_COLOUR};
+    for (int i = 0; i < 3; i++)
+        channels[i] = (uint8_t)(channels[i] + ((clear[i] - channels[i]) * amount));
+    return texel;
+}
+
+// Rasterizes one triangle inside a rectangle of the screen, x2/y2 are exclusive
+static void trs_RasterTriangleRect(trs_Rasterizer *raster, const trs_RasterTriangle *tri, int x1, int y1, int x2, int y2) {
+    const trs_TexturePixels *texture = tri->texture;
+    const bool fog = raster->fogEnd > raster->fogStart;
+    for (int y = y1; y < y2; y++) {
+        float *depthRow = &raster->depth[y * raster->width];
+        uint32_t *colourRow = &raster->pixels[y * raster->pitch];
+        const float px = x1 + 0.5f;
+        const float py = y + 0.5f;
+        float e0 = (tri->a[0] * px) + (tri->b[0] * py) + tri->c[0];
+        float e1 = (tri->a[1] * px) + (tri->b[1] * py) + tri->c[1];
+        float e2 = (tri->a[2] * px) + (tri->b[2] * py) + tri->c[2];
+#ifdef TRS_RASTER_SSE
+        // Four pixels at a time
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 lanes = _mm_set_ps(3, 2, 1, 0);
+        __m128 edge0 = _mm_add_ps(_mm_set1_ps(e0), _mm_mul_ps(lanes, _mm_set1_ps(tri->a[0])));
+        __m128 edge1 = _mm_add_ps(_mm_set1_ps(e1), _mm_mul_ps(lanes, _mm_set1_ps(tri->a[1])));
+        __m128 edge2 = _mm_add_ps(_mm_set1_ps(e2), _mm_mul_ps(lanes, _mm_set1_ps(tri->a[2])));
+        const __m128 step0 = _mm_set1_ps(tri->a[0] * 4);
+        const __m128 step1 = _mm_set1_ps(tri->a[1] * 4);
+        const __m128 step2 = _mm_set1_ps(tri->a[2] * 4);
+        const __m128 z0 = _mm_set1_ps(tri->z[0] * tri->invArea);
+        const __m128 z1 = _mm_set1_ps(tri->z[1] * tri->invArea);
+        const __m128 z2 = _mm_set1_ps(tri->z[2] * tri->invArea);
+        for (int x = x1; x < x2; x += 4) {
+            const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_cmpge_ps(edge1, zero)), _mm_cmpge_ps(edge2, zero));
+            int mask = _mm_movemask_ps(inside);
+            if (x2 - x < 4)
+                mask &= (1 << (x2 - x)) - 1;
+            if (mask != 0) {
+                const __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge0, z0), _mm_mul_ps(edge1, z1)), _mm_mul_ps(edge2, z2));
+                mask &= _mm_movemask_ps(_mm_cmplt_ps(z, _mm_loadu_ps(&depthRow[x])));
+                if (mask != 0) {
+                    float depths[4], l0[4], l1[4], l2[4];
+                    _mm_storeu_ps(depths, z);
+                    _mm_storeu_ps(l0, edge0);
+                    _mm_storeu_ps(l1, edge1);
+                    _mm_storeu_ps(l2, edge2);
+                    for (int i = 0; i < 4; i++) {
+                        if ((mask & (1 << i)) == 0)
+                            continue;
+                        const float invW = (l0[i] * tri->invW[0]) + (l1[i] * tri->invW[1]) + (l2[i] * tri->invW[2]);
+                        const float u = ((l0[i] * tri->uOverW[0]) + (l1[i] * tri->uOverW[1]) + (l2[i] * tri->uOverW[2])) / invW;
+                        const float v = ((l0[i] * tri->vOverW[0]) + (l1[i] * tri->vOverW[1]) + (l2[i] * tri->vOverW[2])) / invW;
+                        const int tx = clamp(u * texture->w, 0, texture->w - 1);
+                        const int ty = clamp(v * texture->h, 0, texture->h - 1);
+                        const uint32_t texel = texture->pixels[(ty * texture->w) + tx];
+                        if (((const uint8_t*)&texel)[3] >= 128) {
+                            colourRow[x + i] = fog ? trs_RasterFog(raster, texel, invW * tri->invArea) : texel;
+                            depthRow[x + i] = depths[i];
+                        }
+                    }
+                }
+            }
+            edge0 = _mm_add_ps(edge0, step0);
+            edge1 = _mm_add_ps(edge1, step1);
+            edge2 = _mm_add_ps(edge2, step2);
+        }
+#else
+        for (int x = x1; x < x2; x++) {
+            if (e0 >= 0 && e1 >= 0 && e2 >= 0) {
+                const float z = ((e0 * tri->z[0]) + (e1 * tri->z[1]) + (e2 * tri->z[2])) * tri->invArea;
+                if (z < depthRow[x]) {
+                    const float invW = (e0 * tri->invW[0]) + (e1 * tri->invW[1]) + (e2 * tri->invW[2]);
+                    const float u = ((e0 * tri->uOverW[0]) + (e1 * tri->uOverW[1]) + (e2 * tri->uOverW[2])) / invW;
+                    const float v = ((e0 * tri->vOverW[0]) + (e1 * tri->vOverW[1]) + (e2 * tri->vOverW[2])) / invW;
+                    const int tx = clamp(u * texture->w, 0, texture->w - 1);
+                    const int ty = clamp(v * texture->h, 0, texture->h - 1);
+                    const uint32_t texel = texture->pixels[(ty * texture->w) + tx];
+                    if (((const uint8_t*)&texel)[3] >= 128) {
+                        colourRow[x] = fog ? trs_RasterFog(raster, texel, invW * tri->invArea) : texel;
+                        depthRow[x] = z;
+                    }
+                }
+            }
+            e0 += tri->a[0];
+            e1 += tri->a[1];
+            e2 += tri->a[2];
+        }
+#endif
+    }
+}
+
+// Clears a tile and draws every triangle binned to it
+static void trs_RasterTile(trs_Rasterizer *raster, int tile) {
+    const int x1 = (tile % raster->tilesX) * TRS_TILE_SIZE;
+    const int y1 = (tile / raster->tilesX) * TRS_TILE_SIZE;
+    const int x2 = x1 + TRS_TILE_SIZE < raster->width ? x1 + TRS_TILE_SIZE : raster->width;
+    const int y2 = y1 + TRS_TILE_SIZE < raster->height ? y1 + TRS_TILE_SIZE : raster->height;
+    for (int y = y1; y < y2; y++) {
+        for (int x = x1; x < x2; x++) {
+            raster->pixels[(y * raster->pitch) + x] = TRS_CLEAR_COLOUR;
+            raster->depth[(y * raster->width) + x] = FLT_MAX;
+        }
+    }
+
+    for (int i = raster->binStarts[tile]; i < raster->binStarts[tile + 1]; i++) {
+        const trs_RasterTriangle *tri = &raster->triangles[raster->bins[i]];
+        trs_RasterTriangleRect(
+                raster, tri,
+                tri->minX > x1 ? tri->minX : x1,
+                tri->minY > y1 ? tri->minY : y1,
+                tri->maxX + 1 < x2 ? tri->maxX + 1 : x2,
+                tri->maxY + 1 < y2 ? tri->maxY + 1 : y2);
+    }
+}
+
+// Takes tiles until there are none left, called from the main thread and every worker
+static void trs_RasterTiles(trs_Rasterizer *raster) {
+    const int tileCount = raster->tilesX * raster->tilesY;
+    int tile;
+    while ((tile = SDL_AtomicAdd(&raster->nextTile, 1)) < tileCount)
+        trs_RasterTile(raster, tile);
+}
+
+static int trs_RasterWorker(void *data) {
+    trs_Rasterizer *raster = data;
+    while (true) {
+        SDL_SemWait(raster->start);
+        if (raster->quit)
+            break;
+        trs_RasterTiles(raster);
+        SDL_SemPost(raster->done);
+    }
+    return 0;
+}
+
+// Makes a screen-space triangle from three clip-space vertices
+static void trs_RasterSetupTriangle(trs_Rasterizer *raster, trs_Vertex *v0, trs_Vertex *v1, trs_Vertex *v2, const trs_TexturePixels *texture) {
+    trs_Vertex *vertices[3] = {v0, v1, v2};
+    float x[3], y[3];
+    trs_RasterTriangle tri;
+    for (int i = 0; i < 3; i++) {
+        const float invW = 1 / vertices[i]->position[3];
+        x[i] = (raster->width / 2.0f) + ((vertices[i]->position[0] * invW) * (raster->width / 2.0f));
+        y[i] = (raster->height / 2.0f) + ((vertices[i]->position[1] * invW) * (raster->height / 2.0f));
+        tri.z[i] = vertices[i]->position[2] * invW;
+        tri.invW[i] = invW;
+        tri.uOverW[i] = vertices[i]->uv[0] * invW;
+        tri.vOverW[i] = vertices[i]->uv[1] * invW;
+    }
+
+    // Edge functions, flipped for clockwise triangles so inside is always positive
+    float area = ((x[1] - x[0]) * (y[2] - y[0])) - ((x[2] - x[0]) * (y[1] - y[0]));
+    if (area == 0)
+        return;
+    const float sign = area > 0 ? 1 : -1;
+    for (int i = 0; i < 3; i++) {
+        const int j = (i + 1) % 3;
+        const int k = (i + 2) % 3;
+        tri.a[i] = (y[j] - y[k]) * sign;
+        tri.b[i] = (x[k] - x[j]) * sign;
+        tri.c[i] = ((x[j] * y[k]) - (x[k] * y[j])) * sign;
+    }
+    tri.invArea = 1 / (area * sign);
+
+    // Screen bounds
+    float minX = x[0], maxX = x[0], minY = y[0], maxY = y[0];
+    for (int i = 1; i < 3; i++) {
+        minX = x[i] < minX ? x[i] : minX;
+        maxX = x[i] > maxX ? x[i] : maxX;
+        minY = y[i] < minY ? y[i] : minY;
+        maxY = y[i] > maxY ? y[i] : maxY;
+    }
+    tri.minX = clamp(floorf(minX), 0, raster->width - 1);
+    tri.minY = clamp(floorf(minY), 0, raster->height - 1);
+    tri.maxX = clamp(ceilf(maxX), 0, raster->width - 1);
+    tri.maxY = clamp(ceilf(maxY), 0, raster->height - 1);
+    if (maxX < 0 || maxY < 0 || minX >= raster->width || minY >= raster->height)
+        return;
+    tri.texture = texture;
+
+    trs_Assert(raster->triangleCount < raster->triangleSize);
+    raster->triangles[raster->triangleCount++] = tri;
+}
+
+// Linear interpolation between two clip-space vertices
+static void trs_LerpVertex(trs_Vertex *v1, trs_Vertex *v2, float t, trs_Vertex *out) {
+    for (int i = 0; i < 4; i++)
+        out->position[i] = v1->position[i] + ((v2->position[i] - v1->position[i]) * t);
+    out->uv[0] = v1->uv[0] + ((v2->uv[0] - v1->uv[0]) * t);
+    out->uv[1] = v1->uv[1] + ((v2->uv[1] - v1->uv[1]) * t);
+}
+
+// Clips a clip-space triangle against the near plane and sets up what's left
+static void trs_RasterClipTriangle(trs_Rasterizer *raster, trs_Vertex *triangle, const trs_TexturePixels *texture) {
+    trs_Vertex out[4];
+    int outCount = 0;
+    for (int i = 0; i < 3; i++) {
+        trs_Vertex *current = &triangle[i];
+        trs_Vertex *next = &triangle[(i + 1) % 3];
+        const float currentDistance = current->position[2] + current->position[3];
+        const float nextDistance = next->position[2] + next->position[3];
+        if (currentDistance >= 0)
+            out[outCount++] = *current;
+        if ((currentDistance >= 0) != (nextDistance >= 0))
+            trs_LerpVertex(current, next, currentDistance / (currentDistance - nextDistance), &out[outCount++]);
+    }
+    for (int i = 2; i < outCount; i++)
+        trs_RasterSetupTriangle(raster, &out[0], &out[i - 1], &out[i], texture);
+}
+
+// Puts every triangle index in the bins of the tiles its bounds overlap
+static void trs_RasterBin(trs_Rasterizer *raster) {
+    const int tileCount = raster->tilesX * raster->tilesY;
+    memset(raster->binStarts, 0, sizeof(int) * (tileCount + 1));
+
+    // Count each tile's triangles, then turn the counts into offsets
+    int total = 0;
+    for (int i = 0; i < raster->triangleCount; i++) {
+        const trs_RasterTriangle *tri = &raster->triangles[i];
+        for (int ty = tri->minY / TRS_TILE_SIZE; ty <= tri->maxY / TRS_TILE_SIZE; ty++)
+            for (int tx = tri->minX / TRS_TILE_SIZE; tx <= tri->maxX / TRS_TILE_SIZE; tx++)
+                raster->binStarts[(ty * raster->tilesX) + tx + 1]++;
+    }
+    for (int i = 1; i <= tileCount; i++)
+        raster->binStarts[i] += raster->binStarts[i - 1];
+    total = raster->binStarts[tileCount];
+    raster->bins = trs_FrameAlloc(sizeof(int) * total);
+
+    // Fill the bins in submission order
+    int *fill = trs_FrameAlloc(sizeof(int) * tileCount);
+    memcpy(fill, raster->binStarts, sizeof(int) * tileCount);
+    for (int i = 0; i < raster->triangleCount; i++) {
+        const trs_RasterTriangle *tri = &raster->triangles[i];
+        for (int ty = tri->minY / TRS_TILE_SIZE; ty <= tri->maxY / TRS_TILE_SIZE; ty++)
+            for (int tx = tri->minX / TRS_TILE_SIZE; tx <= tri->maxX / TRS_TILE_SIZE; tx++)
+                raster->bins[fill[(ty * raster->tilesX) + tx]++] = i;
     }
-    free(triangleDepths);
+}
+
+// Sets up the buffers and texture for a resolution, the worker threads are left alone
+static void trs_RasterizerResize(trs_Rasterizer *raster, int width, int height) {
+    raster->width = width;
+    raster->height = height;
+    raster->tilesX = (width + TRS_TILE_SIZE - 1) / TRS_TILE_SIZE;
+    raster->tilesY = (height + TRS_TILE_SIZE - 1) / TRS_TILE_SIZE;
+    raster->depth = trs_CheckMem(realloc(raster->depth, sizeof(float) * ((width * height) + 4))); // padded for 4-wide loads
+    raster->binStarts = trs_CheckMem(realloc(raster->binStarts, sizeof(int) * ((raster->tilesX * raster->tilesY) + 1)));
+    if (raster->texture != NULL)
+        SDL_DestroyTexture(raster->texture);
+    raster->texture = SDL_CreateTexture(gGameState->renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, width, height);
+    trs_CheckSDL(raster->texture);
+}
+
+static void trs_RasterizerCreate(trs_Rasterizer *raster, int width, int height) {
+    trs_RasterizerResize(raster, width, height);
+
+    // Workers, the main thread rasterizes too
+    raster->start = SDL_CreateSemaphore(0);
+    raster->done = SDL_CreateSemaphore(0);
+    raster->quit = false;
+    raster->threadCount = clamp(SDL_GetCPUCount() - 1, 0, TRS_MAX_RASTER_THREADS);
+    for (int i = 0; i < raster->threadCount; i++) {
+        raster->threads[i] = SDL_CreateThread(trs_RasterWorker, "trs_RasterWorker", raster);
+        trs_CheckSDL(raster->threads[i]);
+    }
+}
+
+static void trs_RasterizerDestroy(trs_Rasterizer *raster) {
+    if (raster->texture == NULL)
+        return;
+    raster->quit = true;
+    for (int i = 0; i < raster->threadCount; i++)
+        SDL_SemPost(raster->start);
+    for (int i = 0; i < raster->threadCount; i++)
+        SDL_WaitThread(raster->threads[i], NULL);
+    SDL_DestroySemaphore(raster->start);
+    SDL_DestroySemaphore(raster->done);
+    SDL_DestroyTexture(raster->texture);
+    free(raster->depth);
+    free(raster->binStarts);
+    memset(raster, 0, sizeof(struct trs_Rasterizer_t));
+}
+
+// Rasterizes the clip-space triangles in the backbuffer into the rasterizer's texture
+static void trs_Rasterize() {
+    trs_Rasterizer *raster = &gGameState->rasterizer;
+    trs_TriangleList *list = &gGameState->backbuffer;
+
+    // Triangle setup, clipping against the near plane makes at most two triangles out of one
+    raster->triangleCount = 0;
+    raster->triangleSize = ((list->count / 3) * 2) + 1;
+    raster->triangles = trs_FrameAlloc(sizeof(struct trs_RasterTriangle_t) * raster->triangleSize);
+    SDL_Texture *lastTexture = NULL;
+    const trs_TexturePixels *pixels = NULL;
+    for (int i = 0; i < list->count / 3; i++) {
+        if (list->info[i].texture != lastTexture) {
+            lastTexture = list->info[i].texture;
+            pixels = trs_GetTexturePixels(lastTexture);
+        }
+        if (pixels != NULL)
+            trs_RasterClipTriangle(raster, &list->vertices[i * 3], pixels);
+    }
+    trs_RasterBin(raster);
+
+    // Split the tiles between every thread
+    void *pixelData;
+    SDL_LockTexture(raster->texture, NULL, &pixelData, &raster->pitch);
+    raster->pixels = pixelData;
+    raster->pitch /= 4;
+    SDL_AtomicSet(&raster->nextTile, 0);
+    for (int i = 0; i < raster->threadCount; i++)
+        SDL_SemPost(raster->start);
+    trs_RasterTiles(raster);
+    for (int i = 0; i < raster->threadCount; i++)
+        SDL_SemWait(raster->done);
+    SDL_UnlockTexture(raster->texture);
+}
+
+void trs_SetBackend(trs_Backend backend) {
+    if (backend == TRS_BACKEND_SOFTWARE && gGameState->rasterizer.texture == NULL)
+        trs_RasterizerCreate(&gGameState->rasterizer, gGameState->targetWidth, gGameState->targetHeight);
+    gGameState->backend = backend;
+    gGameState->frameValid = false;
+}
+
+trs_Backend trs_GetBackend() {
+    return gGameState->backend;
 }
 
 SDL_Texture *trs_EndFrame(float *width, float *height, bool resetTarget) {
+    // Render resolution, the governor might be scaling it down
+    float resolutionScale = 1;
+    if (gGameState->governorResolution && gGameState->governor.targetFrameTime > 0)
+        resolutionScale = gGovernorResolutionScales[gGameState->governor.level];
+    trs_ResizeTarget(gGameState->renderWidth * resolutionScale, gGameState->renderHeight * resolutionScale);
+    trs_UpdatePerspective();
+
+    // Nothing changed since the last frame so it can be handed back as is
+    const uint64_t frameHash = trs_FrameHash();
+    if (gGameState->frameReuse && gGameState->frameValid && frameHash == gGameState->frameHash) {
+        trs_ReuseFrame();
+        if (resetTarget)
+            SDL_SetRenderTarget(gGameState->renderer, NULL);
+        if (width != NULL)
+            *width = gGameState->logicalWidth;
+        if (height != NULL)
+            *height = gGameState->logicalHeight;
+        return gGameState->target;
+    }
+    gGameState->frameHash = frameHash;
+    gGameState->frameValid = gGameState->frameReuse;
 
     // Setup view matrix
     vec3 dir = {
@@ -592,6 +3510,10 @@ SDL_Texture *trs_EndFrame(float *width, float *height, bool resetTarget) {
     mat4 vp = GLM_MAT4_IDENTITY_INIT;
     glm_mat4_mul(gGameState->perspective, view, vp);
 
+    // Throw away hidden instances and turn the rest into triangles
+    trs_OcclusionCull(vp);
+    trs_ExpandBSP();
+
     // Frustrum cull and painters algorithm
     trs_FrustumCull(vp);
 
@@ -600,27 +3522,75 @@ SDL_Texture *trs_EndFrame(float *width, float *height, bool resetTarget) {
         glm_mat4_mulv(vp, gGameState->backbuffer.vertices[i].position, gGameState->backbuffer.vertices[i].position);
     }
 
+    // Triangles facing away from the camera
+    trs_BackfaceCull(&gGameState->backbuffer);
+
+    // The software backend has a depth buffer and doesn't need any sorting
+    if (gGameState->backend == TRS_BACKEND_SOFTWARE) {
+        gTriangleCount = gGameState->backbuffer.count / 3;
+        gGameState->rasterizer.fogStart = gGameState->fogStart;
+        gGameState->rasterizer.fogEnd = gGameState->fogEnd;
+        trs_Rasterize();
+        trs_PresentFrame(gGameState->rasterizer.texture);
+        if (resetTarget)
+            SDL_SetRenderTarget(gGameState->renderer, NULL);
+        if (width != NULL)
+            *width = gGameState->logicalWidth;
+        if (height != NULL)
+            *height = gGameState->logicalHeight;
+        return gGameState->target;
+    }
+
     // Painters
     trs_PaintersAlgorithm();
 
-    // Compile the SDL vertex list
-    for (int i = 0; i < gGameState->triangleList.count; i++) {
+    // Screen positions, uvs are read straight out of the triangle list
+    const int count = gGameState->triangleList.count;
+    const float halfWidth = gGameState->targetWidth / 2.0f;
+    const float halfHeight = gGameState->targetHeight / 2.0f;
+    float *xy = trs_FrameAlloc(sizeof(float) * 2 * (count + 1));
+    for (int i = 0; i < count; i++) {
         float *pos = gGameState->triangleList.vertices[i].position;
-        gGameState->triangleList.verticesSDL[i].position.x = (gGameState->logicalWidth / 2) + ((pos[0] / pos[3]) * (gGameState->logicalWidth / 2));
-        gGameState->triangleList.verticesSDL[i].position.y = (gGameState->logicalHeight / 2) + ((pos[1] / pos[3]) * (gGameState->logicalHeight / 2));
-        gGameState->triangleList.verticesSDL[i].tex_coord.x = gGameState->triangleList.vertices[i].uv[0];
-        gGameState->triangleList.verticesSDL[i].tex_coord.y = gGameState->triangleList.vertices[i].uv[1];
-        gGameState->triangleList.verticesSDL[i].color.r = 255;
-        gGameState->triangleList.verticesSDL[i].color.g = 255;
-        gGameState->triangleList.verticesSDL[i].color.b = 255;
-        gGameState->triangleList.verticesSDL[i].color.a = 255;
+        xy[(i * 2)] = halfWidth + ((pos[0] / pos[3]) * halfWidth);
+        xy[(i * 2) + 1] = halfHeight + ((pos[1] / pos[3]) * halfHeight);
+    }
+
+    // Every vertex shares one colour unless fog fades them
+    static const SDL_Color white = {255, 255, 255, 255};
+    const SDL_Color *colours = &white;
+    int colourStride = 0;
+    if (gGameState->fogEnd > gGameState->fogStart) {
+        SDL_Color *fogColours = trs_FrameAlloc(sizeof(SDL_Color) * (count + 1));
+        for (int i = 0; i < count; i++) {
+            fogColours[i] = white;
+            fogColours[i].a = 255 - (Uint8)(trs_FogAmount(gGameState->triangleList.vertices[i].position[3], gGameState->fogStart, gGameState->fogEnd) * 255);
+        }
+        colours = fogColours;
+        colourStride = sizeof(SDL_Color);
     }
 
     // Present the triangle list
-    SDL_SetRenderTarget(gGameState->renderer, gGameState->target);
+    SDL_SetRenderTarget(gGameState->renderer, gGameState->renderTarget);
     SDL_SetRenderDrawColor(gGameState->renderer, 255, 255, 255, 255);
     SDL_RenderClear(gGameState->renderer);
-    SDL_RenderGeometry(gGameState->renderer, gGameState->uvtexture, gGameState->triangleList.verticesSDL, gGameState->triangleList.count, NULL, 0);
+
+    // Draw each run of triangles sharing a texture in one call
+    const int triangles = gGameState->triangleList.count / 3;
+    int runStart = 0;
+    for (int i = 1; i <= triangles; i++) {
+        if (i == triangles || gGameState->triangleList.info[i].texture != gGameState->triangleList.info[runStart].texture) {
+            const int first = runStart * 3;
+            SDL_RenderGeometryRaw(gGameState->renderer, gGameState->triangleList.info[runStart].texture,
+                                  &xy[first * 2], sizeof(float) * 2,
+                                  colourStride == 0 ? colours : &colours[first], colourStride,
+                                  gGameState->triangleList.vertices[first].uv, sizeof(trs_Vertex),
+                                  (i - runStart) * 3, NULL, 0, 0);
+            runStart = i;
+        }
+    }
+    if (gGameState->frameReuse && gGameState->renderTarget == gGameState->target)
+        trs_CacheFrame();
+    trs_PresentFrame(gGameState->renderTarget);
     if (resetTarget)
         SDL_SetRenderTarget(gGameState->renderer, NULL);
     
@@ -632,6 +3602,44 @@ SDL_Texture *trs_EndFrame(float *width, float *height, bool resetTarget) {
     return gGameState->target;
 }
 
+void trs_SetTextureSortBuckets(int buckets) {
+    gGameState->textureSortBuckets = buckets;
+    trs_InvalidateFrame();
+}
+
+void trs_SetSortMode(trs_SortMode sortMode) {
+    gGameState->sortMode = sortMode;
+    gGameState->sortOrderCount = 0;
+    trs_InvalidateFrame();
+}
+
+void trs_SetTemporalSort(bool temporalSort) {
+    gGameState->temporalSort = temporalSort;
+    gGameState->sortOrderCount = 0;
+}
+
+void trs_CameraCut() {
+    gGameState->cameraCut = true;
+}
+
+int trs_GetFullSortCount() {
+    return gGameState->fullSortCount;
+}
+
+trs_BudgetStats trs_GetBudgetStats() {
+    trs_BudgetStats stats = gGameState->budgetStats;
+    stats.frameArenaSpills = gGameState->frameArena->overflowCount;
+    return stats;
+}
+
+size_t trs_GetFrameArenaHighWater() {
+    return trs_ArenaHighWater(gGameState->frameArena);
+}
+
+int trs_GetOccludedCount() {
+    return gGameState->occludedCount;
+}
+
 int trs_GetTriangleCount() {
     return gTriangleCount;
 }
\ No newline at end of file
@@ -9,14 +9,71 @@ typedef enum {
     TRS_RETURN_TYPE_SUCCESS = 0,
 } trs_ReturnType;
 
+typedef enum {
+    TRS_BACKEND_SDL = 0, // SDL_RenderGeometry with painter's algorithm sorting
+    TRS_BACKEND_SOFTWARE = 1, // tiled multithreaded CPU rasterizer with a depth buffer
+} trs_Backend;
+
+typedef enum {
+    TRS_CULL_NONE = 0, // double-sided
+    TRS_CULL_BACK = 1, // cull triangles facing away, counter-clockwise is the front
+    TRS_CULL_FRONT = 2, // for meshes wound the other way
+} trs_CullMode;
+
+typedef enum {
+    TRS_SORT_TRIANGLES = 0, // every triangle is depth sorted
+    TRS_SORT_INSTANCES = 1, // instances are depth sorted and keep their model's presorted triangle order
+} trs_SortMode;
+
+// Budgets for trs_InitExt, everything they cover is allocated up front and going over drops
+// whatever doesn't fit instead of allocating more, 0 for no budget
+typedef struct trs_Config_t {
+    int maxTriangles; // triangles in a frame
+    int maxInstances; // trs_DrawModel calls in a frame
+    int maxUIQuads; // quads in the 2D batch between flushes, glyphs are one each
+    size_t frameArenaSize; // starting size of the frame arena, 0 for the default
+    int maxVoices; // sounds playing at once, past it quieter and older ones of no higher priority are cut off
+    int maxVirtualVoices; // positional sounds kept out of earshot, past it older ones of no higher priority are stopped
+    int audioFrequency; // mixing rate, 0 for 44100
+    int audioLatency; // frames mixed ahead of the device, 0 to start small and grow only when the device underruns
+    int audioMixDelay; // milliseconds the mix thread sleeps between mixes, 0 for cute_sound's default
+} trs_Config;
+
+// What was dropped for going over budget since trs_Init
+typedef struct trs_BudgetStats_t {
+    int droppedTriangles;
+    int droppedInstances;
+    int droppedQuads;
+    int frameArenaSpills; // frame arena allocations that had to go to the heap, the arena grows after them
+} trs_BudgetStats;
+
+// Sound mixer counters since trs_Init
+typedef struct trs_AudioStats_t {
+    int activeVoices; // playing right now, including virtual ones
+    int virtualVoices; // positional voices out of earshot, not mixed and counted against maxVirtualVoices instead of maxVoices
+    int stolenVoices; // cut off to make room for another sound, or stopped out of earshot for going over maxVirtualVoices
+    int rejectedVoices; // not played because every voice was more important
+    int queuedFrames; // mixed and waiting for the device right now
+    int latencyFrames; // what the mixer keeps queued
+    int underruns; // times the device ran out of mixed audio
+} trs_AudioStats;
+
 typedef struct trs_Vertex_t {
     vec4 position;
     vec2 uv;
 } trs_Vertex;
 
+typedef struct trs_TriangleInfo_t {
+    SDL_Texture *texture;
+    trs_CullMode cullMode;
+    int id; // stable across frames as long as the same things are drawn in the same order
+    int stream; // 0 to be depth sorted, otherwise a stream that is already in back to front order
+    float streamDepth; // depth the instance stream is ordered by, it's merged with the other streams by this
+} trs_TriangleInfo;
+
 typedef struct trs_TriangleList_t {
     trs_Vertex *vertices;
-    SDL_Vertex *verticesSDL;
+    trs_TriangleInfo *info; // one per triangle
     int count;
     int size;
 } trs_TriangleList;
@@ -27,8 +84,20 @@ typedef struct trs_Camera_t {
     float rotationZ;
 } trs_Camera;
 
+struct trs_Image_t {
+    SDL_Texture *texture; // texture the image currently lives in, its own or an atlas page
+    SDL_Rect rect; // where the image is in texture
+    int textureWidth;
+    int textureHeight;
+    vec2 uvOffset; // image uvs map to texture uvs as uvOffset + (uv * uvScale)
+    vec2 uvScale;
+    uint32_t *pixels; // RGBA pixels, kept until the image is packed into an atlas
+    bool ownsTexture;
+};
+typedef struct trs_Image_t *trs_Image;
+
 struct trs_Font_t {
-    SDL_Texture *bitmap;
+    trs_Image bitmap;
     int w;
     int h;
 };
@@ -38,20 +107,58 @@ struct trs_Hitbox_t {
     vec3 box[2];
 };
 typedef struct trs_Hitbox_t *trs_Hitbox;
-typedef void *trs_Sound;
+typedef struct trs_Sound_t *trs_Sound;
+typedef Uint64 trs_VoiceID; // a sound that was played, 0 if it didn't start
+
+typedef struct trs_ModelGroup_t {
+    trs_Image texture; // NULL for the global texture
+    int first; // first vertex in the group
+    int count;
+} trs_ModelGroup;
 
 struct trs_Model_t {
     trs_Vertex *vertices;
     trs_Hitbox hitbox;
     int count;
+    trs_ModelGroup *groups; // faces sharing a material, vertices are stored in group order
+    int groupCount;
+    bool occluder; // drawn into the occlusion buffer to hide the instances behind it
+    trs_CullMode cullMode;
+    int *sortOrders; // back to front triangle orders for a handful of view directions
+    struct trs_Model_t *lod; // simpler model drawn past lodDistance, NULL for none
+    float lodDistance;
 };
 typedef struct trs_Model_t *trs_Model;
+typedef struct trs_BSP_t *trs_BSP;
+typedef struct trs_Arena_t *trs_Arena;
+typedef struct trs_Stream_t *trs_Stream;
 
 // Font
 trs_Font trs_LoadFont(const char *filename, int w, int h); // Expects each character to be w*h and ascii 32-128
-void trs_DrawFont(trs_Font font, float x, float y, const char *fmt, ...);
+void trs_DrawFont(trs_Font font, float x, float y, const char *fmt, ...); // queued in the 2D batch
 void trs_FreeFont(trs_Font font);
 
+// Arenas - linear allocators where everything is freed at once
+trs_Arena trs_CreateArena(size_t size);
+void *trs_ArenaAlloc(trs_Arena arena, size_t size); // 16 byte aligned, spills to the heap instead of failing when full
+void trs_ArenaReset(trs_Arena arena); // frees everything, grows the arena to its high-water mark if anything spilled
+size_t trs_ArenaHighWater(trs_Arena arena); // most bytes ever allocated between resets
+void trs_FreeArena(trs_Arena arena);
+void *trs_FrameAlloc(size_t size); // scratch memory from the renderer's frame arena, freed by the next trs_BeginFrame
+
+// Images & atlas
+trs_Image trs_LoadImage(const char *filename); // usable right away and packed into an atlas page by trs_BuildAtlas
+void trs_BuildAtlas(); // packs every image loaded since the last call into as few textures as possible
+void trs_FreeImage(trs_Image image);
+
+// 2D batching - everything is queued and drawn in as few calls as possible by trs_Batch2DFlush
+void trs_Batch2DSetLayer(int layer); // following items are drawn over items on lower layers, resets to 0 every flush
+void trs_Batch2DTexture(SDL_Texture *texture, SDL_Rect *src, float x, float y, float w, float h); // src may be NULL for the whole texture
+void trs_Batch2DImage(trs_Image image, SDL_Rect *src, float x, float y, float w, float h); // src is relative to the image
+void trs_Batch2DLine(float x1, float y1, float x2, float y2, SDL_Color color);
+void trs_Batch2DPoint(float x, float y, SDL_Color color);
+void trs_Batch2DFlush(); // draws everything queued to the current render target
+
 // Triangle lists
 void trs_TriangleListEmpty(trs_TriangleList *list);
 void trs_TriangleListReset(trs_TriangleList *list);
@@ -65,22 +172,52 @@ float random();
 // Getters
 trs_Camera *trs_GetCamera();
 int trs_GetTriangleCount();
+int trs_GetOccludedCount(); // instances skipped by occlusion culling last frame
+int trs_GetFullSortCount(); // frames the temporal sort had to sort from scratch
+size_t trs_GetFrameArenaHighWater(); // most scratch memory a single frame has used
+trs_BudgetStats trs_GetBudgetStats();
+trs_AudioStats trs_GetAudioStats();
 SDL_Texture *trs_LoadPNG(const char *filename); // shorthand for stb image
 uint8_t *trs_LoadFile(const char *filename, int *size);
 
 // Model loading/drawing
-trs_Model trs_CreateModel(trs_Vertex *vertices, int count); // the vertex list will be copied
-trs_Model trs_LoadModel(const char *filename); // loads a model from a .obj
-void trs_DrawModel(trs_Model model, mat4 modelMatrix);
+trs_Model trs_CreateModel(trs_Vertex *vertices, int count); // the vertex list will be copied, cull mode is detected like trs_LoadModel
+trs_Model trs_LoadModel(const char *filename); // loads a model from a .obj, with a face group per material in its .mtl
+void trs_SetModelCullMode(trs_Model model, trs_CullMode cullMode); // closed meshes cull back faces by default, open ones are double-sided
+void trs_SetModelTexture(trs_Model model, trs_Image texture); // sets the texture of every face group, NULL for the global texture
+void trs_SetModelGroupTexture(trs_Model model, int group, trs_Image texture);
+void trs_DrawModel(trs_Model model, mat4 modelMatrix); // queued until trs_EndFrame, which may cull it
+void trs_SetModelOccluder(trs_Model model, bool occluder); // for big solid models that hide things behind them, set before adding it to a bsp
+void trs_SetModelLOD(trs_Model model, trs_Model lod, float distance); // draws lod instead past distance, lods can have lods
 void trs_DrawModelExt(trs_Model model, float x, float y, float z, float scaleX, float scaleY, float scaleZ, float rotationX, float rotationY, float rotationZ);
 void trs_FreeModel(trs_Model model);
 
+// BSP trees for static geometry, drawn in back to front order without sorting
+trs_BSP trs_CreateBSP(); // a bsp can be built on any thread as long as it isn't drawn until it's built
+void trs_BSPAddModel(trs_BSP bsp, trs_Model model, mat4 modelMatrix); // copies the model's triangles in world space
+void trs_BSPBuild(trs_BSP bsp); // call after adding everything
+void trs_DrawBSP(trs_BSP bsp); // each bsp drawn in a frame keeps its own order and is merged by depth with the others and dynamic models
+void trs_FreeBSP(trs_BSP bsp);
+
 // Sounds
-trs_Sound trs_LoadSound(const char *filename);
-void trs_PlaySound(trs_Sound sound, float volume, bool looping);
+trs_Sound trs_LoadSound(const char *filename); // resampled to the mixing rate if the wav is at another
+void trs_SaveSound(trs_Sound sound, const char *filename); // as a wav at the mixing rate, so loading it again has nothing to convert
+void trs_SetSoundPriority(trs_Sound sound, int priority); // 0 by default, higher takes voices from lower when out of them
+void trs_SetSoundMaxInstances(trs_Sound sound, int maxInstances); // past it the oldest instance restarts, 0 for no limit
+trs_VoiceID trs_PlaySound(trs_Sound sound, float volume, bool looping);
+trs_VoiceID trs_PlaySound3D(trs_Sound sound, vec3 position, float volume, float radius, bool looping); // fades out and pans from the camera, silent past radius
+void trs_SetVoicePosition(trs_VoiceID voice, vec3 position); // moves a positional sound, nothing happens once it's done playing
+void trs_StopVoice(trs_VoiceID voice); // nothing happens once it's done playing
 void trs_StopAllSound();
 void trs_FreeSound(trs_Sound sound);
 
+// Streamed sounds for long tracks, read from disk a bit at a time while they play
+trs_Stream trs_LoadStream(const char *filename); // 16 bit mono or stereo wav, only the header is read here
+void trs_PlayStream(trs_Stream stream, float volume, bool looping); // restarts it if it's already playing
+void trs_StopStream(trs_Stream stream);
+bool trs_StreamPlaying(trs_Stream stream);
+void trs_FreeStream(trs_Stream stream);
+
 // AABB hitboxes (slight abstraction over cglm)
 trs_Hitbox trs_CreateHitbox(float x1, float y1, float z1, float x2, float y2, float z2);
 bool trs_Collision(trs_Hitbox hb1, float x1, float y1, float z1, trs_Hitbox hb2, float x2, float y2, float z2);
@@ -88,7 +225,24 @@ trs_Hitbox trs_GetModelHitbox(trs_Model model); // returns the hitbox assiciated
 void trs_FreeHitbox(trs_Hitbox hb);
 
 // Core renderer
-void trs_Init(SDL_Renderer *renderer, SDL_Window *window, float logicalWidth, float logicalHeight);
+void trs_Init(SDL_Renderer *renderer, SDL_Window *window, float logicalWidth, float logicalHeight); // no budgets
+void trs_InitExt(SDL_Renderer *renderer, SDL_Window *window, float logicalWidth, float logicalHeight, trs_Config *config);
+void trs_SetBackend(trs_Backend backend);
+trs_Backend trs_GetBackend();
+void trs_SetTextureSortBuckets(int buckets); // >0 groups textures within that many depth slices for fewer draw calls
+void trs_SetSortMode(trs_SortMode sortMode);
+void trs_SetTemporalSort(bool temporalSort); // starts each painter's sort from the last frame's order, or the instance sort's in instance mode
+void trs_CameraCut(); // tells the temporal sort the camera jumped so it sorts from scratch next frame
+void trs_SetGovernor(double targetFrameTime); // seconds per frame to hold by lowering draw distance and detail, 0 for off
+int trs_GetGovernorLevel(); // 0 is full quality
+void trs_SetFarPlane(float farPlane); // draw distance before the governor, 100 by default
+void trs_SetFog(bool fog); // fades to the clear colour approaching the far plane
+void trs_SetGovernorResolution(bool scaleResolution); // lets the governor lower the render resolution as well
+void trs_SetResolution(float width, float height); // 3D render resolution, the ui and trs_EndFrame's size stay at the logical resolution
+void trs_GetResolution(int *width, int *height); // current size of the target, after the governor
+void trs_SetFrameReuse(bool frameReuse); // trs_EndFrame returns the last frame untouched when the camera and everything drawn are the same
+void trs_InvalidateFrame(); // for changes frame reuse can't see, like editing a texture's pixels, safe from any thread
+int trs_GetReusedFrameCount();
 void trs_BeginFrame();
 SDL_Texture *trs_EndFrame(float *width, float *height, bool resetTarget);
 void trs_End();
\ No newline at end of file
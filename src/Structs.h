@@ -8,6 +8,12 @@
 #define MESSAGE_BUFFER_SIZE 1024
 #define MESSAGE_TIME 4.0f
 
+// Level budgets, checkpoints are allocated when the level is created and walls when their chunk is
+// loaded, anything past these is dropped
+#define LEVEL_MAX_CHUNKS 64
+#define LEVEL_MAX_WALLS 64 // per chunk
+#define LEVEL_MAX_CHECKPOINTS 16 // per chunk
+
 typedef enum {
     GAME_ROOM_MENU = 0,
     GAME_ROOM_GAME = 1,
@@ -52,6 +58,11 @@ typedef struct Wall_t {
     float time;
     float moveFactor; // time is multiplied by this
     float stayTime; // time this wall stays at both ends
+
+    // Chunk slot
+    int chunk;
+    int listIndex; // in the chunk's list of active walls
+    int nextFree; // next free slot while this one is free
 } Wall;
 
 typedef struct Checkpoint_t {
@@ -61,13 +72,37 @@ typedef struct Checkpoint_t {
     float time; // time the player hit this checkpoint
     bool playerHit; // If the player has hit this checkpoint this level
     bool active;
+
+    // Chunk slot
+    int chunk;
+    int listIndex; // in the chunk's list of active checkpoints
+    int nextFree; // next free slot while this one is free
 } Checkpoint;
 
+// Where a chunk is in being streamed in, the loader thread only touches chunks that are loading
+typedef enum {
+    CHUNK_UNLOADED = 0,
+    CHUNK_REQUESTED = 1, // waiting on the loader thread
+    CHUNK_LOADING = 2,
+    CHUNK_READY = 3, // loaded and waiting for the main thread to take it
+    CHUNK_LOADED = 4, // belongs to the main thread
+} ChunkState;
+
+// Walls and checkpoints live in slots that don't move and that are listed in a dense list of active
+// slots, free slots are a linked list through the slots themselves
 typedef struct Chunk_t {
-    Wall *walls;
-    int wallCount;
+    SDL_atomic_t state; // a ChunkState
+    Wall *walls; // slots, NULL while the chunk isn't loaded
+    int *wallList; // slots of active walls
+    int wallCount; // active walls
+    int wallSlots; // slots ever used, the ones past this are free too
+    int wallFree; // first free slot, -1 if none
+    trs_BSP bsp; // static walls, built by whoever loads the chunk
     Checkpoint *checkpoints;
+    int *checkpointList;
     int checkpointCount;
+    int checkpointSlots;
+    int checkpointFree;
 } Chunk;
 
 typedef struct Level_t {
@@ -79,6 +114,14 @@ typedef struct Level_t {
     char messageBuffer[MESSAGE_BUFFER_SIZE];
     double messageTime;
     int checkpointID; // for assigning checkpoint ids
+    int droppedCount; // walls and checkpoints that went over the budgets
+    trs_BSP bsp; // ground, each chunk has its own for walls that don't move
+
+    // Streaming
+    struct LevelFileIndex_t *levelFile; // walls are streamed from this, NULL if every chunk stays loaded
+    SDL_Thread *loader;
+    SDL_atomic_t loaderRunning;
+    float chunkDistance; // of the player last frame, for which direction they're going
 } Level;
 
 typedef struct Menu_t {
@@ -105,10 +148,10 @@ typedef struct GameState_t {
 
     // Assets
     trs_Model testModel;
-    SDL_Texture *hintTex;
+    trs_Image hintTex;
     trs_Font font;
     trs_Font menuFont;
-    SDL_Texture *compassTex;
+    trs_Image compassTex;
     trs_Model playerModel;
     trs_Model groundPlane;
     trs_Model platformModel;
@@ -41,7 +41,14 @@ int main(int argc, char *argv[]) {
         .keyboard = (bool*)keyboard,
         .keyboardPrevious = malloc(num)
     };
-    trs_Init(renderer, window, 256, 224);
+    trs_InitExt(renderer, window, 256, 224, &(trs_Config){
+        .maxTriangles = 16384,
+        .maxInstances = 1024,
+        .maxUIQuads = 4096,
+        .frameArenaSize = 4 * 1024 * 1024,
+        .maxVoices = 24,
+        .maxVirtualVoices = 64
+    });
     gameStart(&game);
 
     // Main loop
@@ -0,0 +1,86 @@
+// Compiles a level with checkpoints, then loads the cached file twice the way later launches do and
+// makes sure every load gets the same checkpoints back.
+//     cc -std=c11 -Isrc tests/LevelFileTest.c src/LevelFile.c src/Software3D.c -lSDL2 -lm -o LevelFileTest
+#define SDL_MAIN_HANDLED
+#include <stdio.h>
+#include "LevelFile.h"
+
+static const char *LEVEL_FILE = "LevelFileTest.lvl";
+static const int CHECKPOINTS = 5;
+
+// A level with CHECKPOINTS checkpoints spread over two chunks and no walls
+static void createLevel(Level *level) {
+    *level = (Level){0};
+    level->chunks = calloc(LEVEL_MAX_CHUNKS, sizeof(struct Chunk_t));
+    for (int i = 0; i < LEVEL_MAX_CHUNKS; i++) {
+        level->chunks[i].checkpoints = calloc(LEVEL_MAX_CHECKPOINTS, sizeof(struct Checkpoint_t));
+        level->chunks[i].checkpointList = calloc(LEVEL_MAX_CHECKPOINTS, sizeof(int));
+        level->chunks[i].wallFree = -1;
+        level->chunks[i].checkpointFree = -1;
+    }
+    level->chunkCount = 2;
+    for (int i = 0; i < CHECKPOINTS; i++) {
+        Chunk *chunk = &level->chunks[i % 2];
+        const int slot = chunk->checkpointSlots++;
+        chunk->checkpointList[chunk->checkpointCount++] = slot;
+        chunk->checkpoints[slot] = (Checkpoint){.position = {i, -i, 1}, .index = i, .active = true, .chunk = i % 2};
+    }
+}
+
+static void freeLevel(Level *level) {
+    for (int i = 0; i < LEVEL_MAX_CHUNKS; i++) {
+        free(level->chunks[i].checkpoints);
+        free(level->chunks[i].checkpointList);
+    }
+    free(level->chunks);
+}
+
+// Returns how many checkpoints a load of the cached file got, -1 if the file couldn't be opened
+static int loadCheckpoints(Checkpoint *checkpoints) {
+    LevelFileIndex index = levelFileOpen(LEVEL_FILE, 1);
+    if (index == NULL)
+        return -1;
+    const int count = levelFileLoadCheckpoints(index, checkpoints, LEVEL_MAX_CHECKPOINTS);
+    levelFileClose(index);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    GameState game = {0};
+    Level level;
+    createLevel(&level);
+    int failures = 0;
+    if (!levelFileSave(&game, &level, LEVEL_FILE, 1)) {
+        fprintf(stderr, "Failed to save %s.\n", LEVEL_FILE);
+        freeLevel(&level);
+        return 1;
+    }
+
+    Checkpoint first[LEVEL_MAX_CHECKPOINTS];
+    Checkpoint second[LEVEL_MAX_CHECKPOINTS];
+    const int firstCount = loadCheckpoints(first);
+    const int secondCount = loadCheckpoints(second);
+    if (firstCount != CHECKPOINTS || secondCount != firstCount) {
+        fprintf(stderr, "Saved %i checkpoints but loaded %i then %i.\n", CHECKPOINTS, firstCount, secondCount);
+        failures++;
+    }
+
+    // They come back in the order they were added
+    for (int i = 0; i < firstCount && i < secondCount; i++) {
+        if (first[i].position[0] != i || first[i].position[1] != -i || memcmp(first[i].position, second[i].position, sizeof(vec3)) != 0) {
+            fprintf(stderr, "Checkpoint %i loaded at a different position.\n", i);
+            failures++;
+        }
+    }
+
+    // A different source hash means the cache is stale
+    if (levelFileOpen(LEVEL_FILE, 2) != NULL) {
+        fprintf(stderr, "A stale level file was accepted.\n");
+        failures++;
+    }
+
+    freeLevel(&level);
+    remove(LEVEL_FILE);
+    printf("%i failures\n", failures);
+    return failures == 0 ? 0 : 1;
+}
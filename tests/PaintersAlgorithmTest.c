@@ -0,0 +1,81 @@
+// Runs frames through the SDL backend's painter's algorithm, whose scratch memory all comes from the
+// frame arena and must never be handed to free. Build it with ASan so a free of arena memory is reported
+// as a bad free the first frame it happens. The frame arena also has to stay the same size with nothing
+// spilling to the heap once the scene is steady. Run from the repository root.
+//     cc -std=c11 -fsanitize=address -Isrc tests/PaintersAlgorithmTest.c src/Software3D.c -lSDL2 -lm -o PaintersAlgorithmTest
+#define SDL_MAIN_HANDLED
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "Software3D.h"
+
+static const int FRAMES = 10;
+static const size_t FRAME_ARENA_SIZE = 256 * 1024; // plenty for this scene, so nothing should spill
+
+// A quad in front of another quad so there is something to sort
+static trs_Vertex QUADS[] = {
+    {{-1, -1, 0, 1}, {0, 0}}, {{1, -1, 0, 1}, {1, 0}}, {{1, 1, 0, 1}, {1, 1}},
+    {{-1, -1, 0, 1}, {0, 0}}, {{1, 1, 0, 1}, {1, 1}}, {{-1, 1, 0, 1}, {0, 1}},
+    {{-1, -1, 1, 1}, {0, 0}}, {{1, -1, 1, 1}, {1, 0}}, {{1, 1, 1, 1}, {1, 1}},
+    {{-1, -1, 1, 1}, {0, 0}}, {{1, 1, 1, 1}, {1, 1}}, {{-1, 1, 1, 1}, {0, 1}},
+};
+
+int main(int argc, char *argv[]) {
+    SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+        return 1;
+    }
+    SDL_Window *window = SDL_CreateWindow("PaintersAlgorithmTest", 0, 0, 256, 224, SDL_WINDOW_HIDDEN);
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE);
+    trs_InitExt(renderer, window, 256, 224, &(trs_Config){.maxTriangles = 1024, .maxInstances = 64, .frameArenaSize = FRAME_ARENA_SIZE});
+    trs_SetBackend(TRS_BACKEND_SDL);
+    trs_SetTemporalSort(true);
+
+    trs_Model model = trs_CreateModel(QUADS, sizeof(QUADS) / sizeof(trs_Vertex));
+    trs_SetModelCullMode(model, TRS_CULL_NONE);
+    trs_Camera *camera = trs_GetCamera();
+    camera->eyes[0] = -6;
+    camera->eyes[2] = 0.5;
+
+    // Every frame sorts, merges and resets the frame arena, moving the camera keeps the sort busy
+    int failures = 0;
+    size_t highWater = 0;
+    for (int i = 0; i < FRAMES; i++) {
+        trs_BeginFrame();
+        for (int j = 0; j < 4; j++)
+            trs_DrawModelExt(model, 0, j * 0.5f, j * 0.25f, 1, 1, 1, 0, 0, 0);
+        float width, height;
+        trs_EndFrame(&width, &height, true);
+        if (trs_GetTriangleCount() == 0) {
+            fprintf(stderr, "Frame %i drew no triangles.\n", i);
+            failures++;
+        }
+
+        // The first frame sets how much scratch memory the scene takes, every frame after uses the same
+        if (i == 0) {
+            highWater = trs_GetFrameArenaHighWater();
+        } else if (trs_GetFrameArenaHighWater() != highWater) {
+            fprintf(stderr, "Frame %i grew the frame arena's high-water mark from %zu to %zu bytes.\n", i, highWater, trs_GetFrameArenaHighWater());
+            highWater = trs_GetFrameArenaHighWater();
+            failures++;
+        }
+        camera->eyes[1] += 0.1f;
+    }
+
+    if (highWater == 0 || highWater > FRAME_ARENA_SIZE) {
+        fprintf(stderr, "Frames used %zu bytes of a %zu byte frame arena.\n", highWater, FRAME_ARENA_SIZE);
+        failures++;
+    }
+    if (trs_GetBudgetStats().frameArenaSpills != 0) {
+        fprintf(stderr, "%i frame arena allocations spilled to the heap.\n", trs_GetBudgetStats().frameArenaSpills);
+        failures++;
+    }
+
+    trs_FreeModel(model);
+    trs_End();
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    printf("%i frames, %i failures\n", FRAMES, failures);
+    return failures == 0 ? 0 : 1;
+}